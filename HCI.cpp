@@ -99,6 +99,81 @@ bool display_initialization_or_reset(hci_event_pckt *event_pckt, DUMMY_ARG) {
   return handled;
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// recover from unexpected resets
+//
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static stack_configuration_t * stack_configuration = NULL;
+static reset_recovery_hook_t * reset_recovery_hook = NULL;
+
+static unsigned int  num_recoveries = 0;
+static unsigned long last_recovery_time = 0;
+static unsigned long max_recovery_time = 0;
+
+// called by the procedures that set the GATT/GAP role so that the same role can be set again after a reset
+void remember_stack_configuration(stack_configuration_t * configure) { stack_configuration = configure; }
+
+stack_configuration_t * get_stack_configuration() { return stack_configuration; }
+
+void on_reset_recovery(reset_recovery_hook_t * hook) { reset_recovery_hook = hook; }
+
+// a reset is unexpected if it wasn't a normal startup or one of the updater modes
+bool check_unexpected_reset(hci_event_pckt *event_pckt) {
+  evt_blue_aci *evt_blue;
+  evt_hal_initialized * reset_pckt; 
+  if (event_pckt->evt != EVT_VENDOR) return false;
+  evt_blue = (evt_blue_aci *) (event_pckt->data);
+  if (evt_blue->ecode != EVT_BLUE_HAL_INITIALIZED) return false;
+  reset_pckt = (evt_hal_initialized *) (event_pckt->data);
+  switch (reset_pckt->reason_code) {
+    case RESET_WATCHDOG:
+    case RESET_LOCKUP:
+    case RESET_BROWNOUT:
+    case RESET_CRASH:
+    case RESET_ECC_ERR:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool recover_from_reset(hci_event_pckt *event_pckt, DUMMY_ARG) {
+  unsigned long start = millis();
+  protocol_ptr_t interrupted[MAX_SUSPENDED_PROTOCOLS + 1];
+  int num_interrupted = 0, to_abort, i;
+  bool success = true;
+  display_initialization_or_reset(event_pckt, NO_ARGS);
+  PRINTF("unexpected reset of BlueNRG, recovering\n")
+  set_public_MAC_addr();
+  if (stack_configuration && !(*stack_configuration)()) {
+    DBMSG(DBL_ERRORS, "*** could not restore stack configuration after reset")
+    success = false;
+  }
+  // any connection or procedure in progress is gone, so the current protocol can't continue, nor can any it suspended (each abort
+  // resumes the next suspended one); the hook is only called once they are all aborted, so a protocol it restarts isn't aborted too
+  to_abort = get_current_protocol() ? 1 + num_suspended_protocols() : 0;
+  while ((num_interrupted < to_abort) && get_current_protocol()) {
+    interrupted[num_interrupted++] = get_current_protocol();
+    PRINTF("aborting protocol %s interrupted by reset\n", get_protocol_name())
+    abort_current_protocol();
+  }
+  if (reset_recovery_hook) {
+    if (num_interrupted == 0) (*reset_recovery_hook)(NULL);
+    for (i = 0; i < num_interrupted; i++) (*reset_recovery_hook)(interrupted[i]);
+  }
+  last_recovery_time = millis() - start;
+  if (last_recovery_time > max_recovery_time) max_recovery_time = last_recovery_time;
+  num_recoveries++;
+  PRINTF("recovered from reset in %lu ms\n", last_recovery_time)
+  return success;
+}
+
+void print_reset_recovery_stats() {
+  PRINTF("resets recovered: %u, last recovery time: %lu ms, max recovery time: %lu ms\n", num_recoveries, last_recovery_time, max_recovery_time)
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////
 //
 // handle BlueRNG-MS vendor codes
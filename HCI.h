@@ -13,6 +13,13 @@
  *       expect(reset_reason, SPECIFICALLY(RESET_NORMAL), AND_DO(set_MAC_addr_action), WITH(NO_ARGS));
  * This will start HCI, checking for a successful start, and setting the default MAC address for your device.
  * 
+ * If the BlueNRG resets in the middle of things (watchdog, lockup, crash, etc.), everything it was configured with is lost and the current
+ * protocol would otherwise just stall. Adding the following global expectation (before the ones above) recovers from that:
+ *     expect_globally_condition(check_unexpected_reset, AND_DO(recover_from_reset), WITH(NO_ARGS));
+ * Recovery sets the MAC address again, redoes the last GATT/GAP role configuration (remembered automatically by the procedures that set the role),
+ * aborts the current protocol since its connection state is no longer valid, and then calls a hook set with on_reset_recovery so the application
+ * can arrange to resume from the last consistent point (e.g., addr_enumeration_retry to walk the interrupted device again).
+ * 
  *  fine-print: copyright 2021 David Hamilton. This software may be freely copied and used under MIT license (see LICENSE.txt in root directory).
  */
 
@@ -25,6 +32,7 @@
 #ifndef HCI_H
 #define HCI_H
 #include "production.h"
+#include "protocol.h"
 
 #define OUR_MAC_ADDR {0x12, 0x34, 0x00, 0xE1, 0x80, 0x02}
 #define OUR_DEVICE_NAME "BlueNRG-MS"
@@ -45,4 +53,19 @@ bool check_event(hci_event_pckt *event_pckt);
 bool display_initialization_or_reset(hci_event_pckt *event_pckt, DUMMY_ARG);
 bool display_event(hci_event_pckt *event_pckt, DUMMY_ARG);
 
+// recovery from unexpected resets
+
+typedef bool (stack_configuration_t)();
+// called for each protocol aborted by the reset, suspended ones too, once they have all been aborted (or once with NULL if none were)
+typedef void (reset_recovery_hook_t)(protocol_ptr_t interrupted_protocol);
+
+void remember_stack_configuration(stack_configuration_t * configure);
+stack_configuration_t * get_stack_configuration();     // NULL if none was remembered
+void on_reset_recovery(reset_recovery_hook_t * hook);
+
+bool check_unexpected_reset(hci_event_pckt *event_pckt);
+bool recover_from_reset(hci_event_pckt *event_pckt, DUMMY_ARG);
+
+void print_reset_recovery_stats();
+
 #endif
@@ -20,6 +20,7 @@
  * 
  * Notes:
  * - TODO: something more flexible than fixed size array.
+ * - lookups go through a small hash table so that adding an address doesn't get slower as the list grows.
 
  * David Hamilton, 2021
  */
@@ -32,6 +33,7 @@ static uint8_t num_addrs;
 static tBDAddr addr_list[MAX_ADDRS];
 static int connectables[MAX_ADDRS];
 static int public_addrs[MAX_ADDRS];
+static int8_t best_rssis[MAX_ADDRS];
 
 void copy_addr(tBDAddr from, tBDAddr * to) {
   int i;
@@ -57,24 +59,57 @@ void print_addr(tBDAddr addr) {
   PRINTF("%02X", addr[0]);
 }
 
+/*
+ * Every advertising report results in a call to add_addr, so rather than comparing against every address in the list, the addresses are
+ * also put in hash buckets (chained through addr_chain). The list itself stays in the order addresses were found, which is what
+ * print_addrs and the enumeration functions use.
+ */
+
+#define ADDR_HASH_BUCKETS 32  /* power of 2 */
+#define END_OF_CHAIN 0        /* links are index + 1 so that the zero initialized table is empty */
+
+static int16_t addr_buckets[ADDR_HASH_BUCKETS];
+static int16_t addr_chain[MAX_ADDRS];
+
+static uint8_t addr_hash(tBDAddr addr) {
+  // the low order bytes of an address vary the most between devices
+  return (addr[0] ^ (addr[1] << 1) ^ (addr[2] << 2)) & (ADDR_HASH_BUCKETS - 1);
+}
+
 void init_addr_list() {
+  int i;
   num_addrs = 0;
+  for (i=0; i<ADDR_HASH_BUCKETS; i++) addr_buckets[i] = END_OF_CHAIN;
 }
 
+int find_addr(tBDAddr addr) {
+  int i;
+  for (i = addr_buckets[addr_hash(addr)]; i != END_OF_CHAIN; i = addr_chain[i-1]) {
+    if (addrs_match(addr, addr_list[i-1])) return i-1;
+  }
+  return -1;
+}
+
+int num_addrs_in_list() { return num_addrs; }
+
 // add to list if not already in the list
 void add_addr(tBDAddr newaddr, bool connectable, bool public_addr) {
-  bool found = 0;
-  uint8_t addr, index;
-  for (addr=0; addr<num_addrs && !found; addr++) {  
-    for (index=0; index<6  && newaddr[index]==addr_list[addr][index]; index++);
-    if (index==6) found = true;
-  }
-  if (!found) {
+  uint8_t index, bucket;
+  int addr = find_addr(newaddr);
+  if (addr < 0) {
+    if (num_addrs == MAX_ADDRS) {
+      DBMSG(DBL_WARNINGS, "address list is full, ignoring new address")
+      return;
+    }
     for (index=0; index<6; index++) addr_list[num_addrs][index] = newaddr[index];
     if (connectable) connectables[num_addrs] = 1;
     else connectables[num_addrs] = 0; 
     if (public_addr) public_addrs[num_addrs] = 1;
     else public_addrs[num_addrs] = 0;
+    best_rssis[num_addrs] = NO_RSSI;
+    bucket = addr_hash(newaddr);
+    addr_chain[num_addrs] = addr_buckets[bucket];
+    addr_buckets[bucket] = num_addrs + 1;
     num_addrs++;
   }
   else {
@@ -83,6 +118,16 @@ void add_addr(tBDAddr newaddr, bool connectable, bool public_addr) {
   }
 }
 
+// keep the strongest signal seen for each address (e.g., to decide which scanner is best placed to connect)
+void update_addr_rssi(tBDAddr addr, int8_t rssi) {
+  int index = find_addr(addr);
+  if ((index >= 0) && (rssi > best_rssis[index])) best_rssis[index] = rssi;
+}
+
+int8_t get_addr_rssi(int index) { return best_rssis[index]; }
+
+void get_addr(int index, tBDAddr * addr_ptr) { copy_addr(addr_list[index], addr_ptr); }
+
 void print_addrs() {
   uint8_t addr,index;
   PRINTF("\n------------------- ADDR LIST ---------------------------\n");
@@ -135,9 +180,13 @@ bool addr_enumeration_next(tBDAddr * addr_ptr, int * connectable, int * public_a
   for (addr = next_addr; addr < num_addrs && !is_next; addr++) {
     next_addr = addr+1;
     is_next = true;
-    for (index=0; index<8; index++) (*addr_ptr)[index] = addr_list[addr][index];
+    for (index=0; index<6; index++) (*addr_ptr)[index] = addr_list[addr][index];
     *connectable = connectables[addr];
     *public_addr = public_addrs[addr];
   }
   return is_next;
 }
+
+void addr_enumeration_retry() {
+  if (next_addr > 0) next_addr--;
+}
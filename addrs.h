@@ -42,10 +42,20 @@ void init_addr_list();
 
 void add_addr(tBDAddr newaddr, bool connectable, bool public_addr);
 
+int find_addr(tBDAddr addr);   // index of the address in the list or -1 if not found
+int num_addrs_in_list();
+void get_addr(int index, tBDAddr * addr_ptr);
+
+#define NO_RSSI -128
+void update_addr_rssi(tBDAddr addr, int8_t rssi);  // only kept for addresses already in the list
+int8_t get_addr_rssi(int index);                   // best RSSI seen or NO_RSSI
+
 void print_addrs();
 
 void addr_enumeration_start();
 // connectable & public_addr values: 0 = false, 1 = true, -1 = both
 bool addr_enumeration_next(tBDAddr * addr_ptr, int * connectable, int * public_addr); 
+// make the next call to addr_enumeration_next return the same address as the last call (e.g., to redo it after a reset)
+void addr_enumeration_retry();
 
 #endif
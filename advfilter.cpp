@@ -0,0 +1,320 @@
+/*!
+ * @file advfilter.cpp
+ * @brief Implementation of the advertising report filter: verifier, assembler, interpreter, and loading over serial
+ * @details
+ * Since every jump goes forward, the interpreter needs no instruction counter to stop runaway programs; the program counter only
+ * ever increases and the verifier made sure it can't run past the final ret.
+ *
+ *  fine-print: copyright 2021 David Hamilton. This software may be freely copied and used under MIT license (see LICENSE.txt in root directory).
+ */
+
+/*
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include "advfilter.h"
+#include "relay.h"
+#include "dbprint.h"
+
+static advfilter_insn_t program[ADVFILTER_MAX_INSNS];
+static int program_len = 0;     // 0 when no filter is loaded
+static advfilter_stats_t stats;
+static Stream * filter_link = NULL;
+static char text[ADVFILTER_MAX_TEXT];
+static int text_len = 0;
+static char line[40];
+static int line_len = 0;
+static bool line_too_long = false;     // the line being received did not fit in line[]
+
+static const char * mnemonics[af_num_ops] = {"ldb", "ldh", "ldbx", "ldhx", "ldlen", "ldrssi", "ldtype", "ldaddr", "and", "rsh",
+                                             "jeq", "jgt", "jge", "jset", "ja", "find", "ret"};
+
+/*
+ * verifier
+ */
+
+static bool is_conditional(uint8_t op) {
+  return (op == af_jeq) || (op == af_jgt) || (op == af_jge) || (op == af_jset) || (op == af_find);
+}
+
+int advfilter_verify(const advfilter_insn_t * insns, int num_insns) {
+  if ((num_insns < 1) || (num_insns > ADVFILTER_MAX_INSNS)) return 0;
+  for (int i = 0; i < num_insns; i++) {
+    if (insns[i].op >= af_num_ops) return i;
+    // jumps are relative to the next instruction and have to land on an instruction
+    if (is_conditional(insns[i].op) && ((i + 1 + insns[i].jt >= num_insns) || (i + 1 + insns[i].jf >= num_insns))) return i;
+    if ((insns[i].op == af_ja) && (i + 1 + insns[i].k >= num_insns)) return i;
+    if ((insns[i].op == af_ldaddr) && (insns[i].k >= sizeof(tBDAddr))) return i;
+  }
+  if (insns[num_insns - 1].op != af_ret) return num_insns - 1;
+  return -1;
+}
+
+/*
+ * assembler
+ */
+
+static bool is_space(char c) { return (c == ' ') || (c == '\t') || (c == ','); }
+
+// parses one line into insn; returns false if it is bad, and sets *empty if there is no instruction on it
+static bool assemble_line(const char * start, const char * end, advfilter_insn_t * insn, bool * empty) {
+  char mnemonic[8];
+  unsigned long operands[3] = {0, 0, 0};
+  int len = 0, num_operands = 0;
+  const char * p = start;
+  char * after;
+  *empty = false;
+  while ((p < end) && is_space(*p)) p++;
+  while ((p < end) && !is_space(*p) && (*p != ';') && (*p != '\r')) {
+    if (len >= (int) sizeof(mnemonic) - 1) return false;
+    mnemonic[len++] = *p++;
+  }
+  mnemonic[len] = 0;
+  if (len == 0) {
+    *empty = true;
+    return true;
+  }
+  for (insn->op = 0; insn->op < af_num_ops; insn->op++) {
+    if (strcmp(mnemonic, mnemonics[insn->op]) == 0) break;
+  }
+  if (insn->op == af_num_ops) return false;
+  while (true) {
+    while ((p < end) && is_space(*p)) p++;
+    if ((p >= end) || (*p == ';') || (*p == '\r')) break;
+    if (num_operands == 3) return false;
+    operands[num_operands++] = strtoul(p, &after, 0);
+    if ((after == p) || (after > end)) return false;
+    p = after;
+  }
+  if ((operands[0] > 0xFFFF) || (operands[1] > 0xFF) || (operands[2] > 0xFF)) return false;
+  insn->k = operands[0];
+  insn->jt = operands[1];
+  insn->jf = operands[2];
+  return true;
+}
+
+int advfilter_assemble(const char * source, advfilter_insn_t * insns, int max_insns) {
+  int num_insns = 0, line_num = 1;
+  const char * start = source;
+  const char * end;
+  bool empty;
+  while (*start) {
+    end = strchr(start, '\n');
+    if (!end) end = start + strlen(start);
+    if (num_insns >= max_insns) return -line_num;
+    if (!assemble_line(start, end, &(insns[num_insns]), &empty)) return -line_num;
+    if (!empty) num_insns++;
+    start = *end ? end + 1 : end;
+    line_num++;
+  }
+  return num_insns;
+}
+
+/*
+ * interpreter
+ */
+
+// offset of the data of the first AD structure of the given type, or -1
+static int find_ad_structure(uint8_t * data, int len, uint16_t type) {
+  int i = 0;
+  while (i + 1 < len) {
+    if (data[i] == 0) break;
+    if (i + 1 + data[i] > len) break;
+    if (data[i + 1] == type) return i + 2;
+    i += 1 + data[i];
+  }
+  return -1;
+}
+
+bool advfilter_run(const advfilter_insn_t * insns, le_advertising_info * report) {
+  uint8_t * data = report->data_RSSI;
+  int len = report->data_length;
+  unsigned int a = 0;
+  int x = 0, pc = 0, offset;
+  const advfilter_insn_t * insn;
+  while (true) {
+    insn = &(insns[pc++]);
+    switch (insn->op) {
+      case af_ldb:
+        if (insn->k >= len) return false;
+        a = data[insn->k];
+        break;
+      case af_ldh:
+        if (insn->k + 1 >= len) return false;
+        a = data[insn->k] | (data[insn->k + 1] << 8);
+        break;
+      case af_ldbx:
+        if (x + insn->k >= len) return false;
+        a = data[x + insn->k];
+        break;
+      case af_ldhx:
+        if (x + insn->k + 1 >= len) return false;
+        a = data[x + insn->k] | (data[x + insn->k + 1] << 8);
+        break;
+      case af_ldlen:   a = len; break;
+      case af_ldrssi:  a = data[len]; break;
+      case af_ldtype:  a = report->evt_type; break;
+      case af_ldaddr:  a = report->bdaddr[insn->k]; break;
+      case af_and:     a &= insn->k; break;
+      case af_rsh:     a >>= (insn->k & 0x1F); break;
+      case af_jeq:     pc += (a == insn->k) ? insn->jt : insn->jf; break;
+      case af_jgt:     pc += (a > insn->k) ? insn->jt : insn->jf; break;
+      case af_jge:     pc += (a >= insn->k) ? insn->jt : insn->jf; break;
+      case af_jset:    pc += (a & insn->k) ? insn->jt : insn->jf; break;
+      case af_ja:      pc += insn->k; break;
+      case af_find:
+        offset = find_ad_structure(data, len, insn->k);
+        if (offset >= 0) x = offset;
+        pc += (offset >= 0) ? insn->jt : insn->jf;
+        break;
+      case af_ret:     return insn->k != 0;
+      default:         return false;
+    }
+  }
+}
+
+/*
+ * loading
+ */
+
+bool advfilter_load(const advfilter_insn_t * insns, int num_insns) {
+  int bad = advfilter_verify(insns, num_insns);
+  if (bad >= 0) {
+    DBPR(DBL_ERRORS, bad, "%d", "*** advertising filter rejected by the verifier at instruction")
+    return false;
+  }
+  memcpy(program, insns, num_insns * sizeof(advfilter_insn_t));
+  program_len = num_insns;
+  memset(&stats, 0, sizeof(stats));
+  return true;
+}
+
+bool advfilter_load_text(const char * source) {
+  advfilter_insn_t insns[ADVFILTER_MAX_INSNS];
+  int num_insns = advfilter_assemble(source, insns, ADVFILTER_MAX_INSNS);
+  if (num_insns < 0) {
+    DBPR(DBL_ERRORS, -num_insns, "%d", "*** advertising filter does not assemble at line")
+    return false;
+  }
+  return advfilter_load(insns, num_insns);
+}
+
+void advfilter_clear() {
+  program_len = 0;
+}
+
+bool advfilter_accepts_report(le_advertising_info * report) {
+  unsigned long start;
+  bool accepted;
+  if (program_len == 0) return true;
+  start = micros();
+  accepted = advfilter_run(program, report);
+  stats.total_us += micros() - start;
+  stats.reports++;
+  if (accepted) stats.accepted++;
+  return accepted;
+}
+
+bool advfilter_accepts(hci_event_pckt *event_pckt) {
+  evt_le_meta_event *meta_pckt;
+  uint8_t num_reports, report_num;
+  uint8_t * report;
+  uint8_t * end;
+  bool accepted = false;
+  if (event_pckt->evt != EVT_LE_META_EVENT) return false;
+  meta_pckt = (evt_le_meta_event *) event_pckt->data;
+  if (meta_pckt->subevent != EVT_LE_ADVERTISING_REPORT) return false;
+  if (program_len == 0) return true;
+  num_reports = meta_pckt->data[0];
+  report = meta_pckt->data + 1;
+  end = event_pckt->data + event_pckt->plen;
+  for (report_num = 0; (report_num < num_reports) && !accepted; report_num++) {
+    // same bounds as relay_advertising_reports: the header, the data, and the RSSI after it have to be in the event
+    if (report + offsetof(le_advertising_info, data_RSSI) > end) break;
+    if (report + offsetof(le_advertising_info, data_RSSI) + ((le_advertising_info *) report)->data_length + 1 > end) break;
+    accepted = advfilter_accepts_report((le_advertising_info *) report);
+    report += offsetof(le_advertising_info, data_RSSI) + ((le_advertising_info *) report)->data_length + 1;
+  }
+  return accepted;
+}
+
+/*
+ * loading over serial
+ */
+
+void advfilter_begin(Stream * link) {
+  filter_link = link;
+  text_len = 0;
+  line_len = 0;
+  line_too_long = false;
+}
+
+static void reply(const char * msg, int value) {
+  char buffer[40];
+  int len = sprintf(buffer, "FILTER %s %d\n", msg, value);
+  if (relay_sends_to(filter_link)) relay_record(relay_filter_reply, 0, 0, (const uint8_t *) buffer, len);
+  else filter_link->print(buffer);
+}
+
+static void process_line() {
+  int num_insns;
+  advfilter_insn_t insns[ADVFILTER_MAX_INSNS];
+  if (strcmp(line, "clear") == 0) {
+    advfilter_clear();
+    text_len = 0;
+    reply("OK", 0);
+  }
+  else if (strcmp(line, "end") == 0) {
+    text[text_len] = 0;
+    text_len = 0;
+    num_insns = advfilter_assemble(text, insns, ADVFILTER_MAX_INSNS);
+    if (num_insns < 0) reply("ERROR line", -num_insns);
+    else if (advfilter_verify(insns, num_insns) >= 0) reply("ERROR instruction", advfilter_verify(insns, num_insns) + 1);
+    else {
+      advfilter_load(insns, num_insns);
+      reply("OK", num_insns);
+    }
+  }
+  else if (text_len + line_len + 1 < ADVFILTER_MAX_TEXT) {
+    memcpy(text + text_len, line, line_len);
+    text_len += line_len;
+    text[text_len++] = '\n';
+  }
+  else {
+    text_len = 0;
+    reply("ERROR too long", ADVFILTER_MAX_TEXT);
+  }
+}
+
+void advfilter_poll() {
+  int c;
+  if (!filter_link) return;
+  while (filter_link->available() > 0) {
+    c = filter_link->read();
+    if (c == '\r') continue;
+    if (c == '\n') {
+      line[line_len] = 0;
+      if (line_too_long) {
+        // a truncated line would assemble as something else, so the whole program is dropped
+        text_len = 0;
+        reply("ERROR line too long", sizeof(line) - 1);
+      }
+      else process_line();
+      line_len = 0;
+      line_too_long = false;
+    }
+    else if (line_len < (int) sizeof(line) - 1) line[line_len++] = c;
+    else line_too_long = true;
+  }
+}
+
+void get_advfilter_stats(advfilter_stats_t * s) { *s = stats; }
+
+void print_advfilter_stats() {
+  PRINTF("advfilter: %d instructions, %lu reports, %lu accepted, ", program_len, stats.reports, stats.accepted)
+  PRINTF("avg %lu ns per report\n", stats.reports ? (stats.total_us * 1000) / stats.reports : 0)
+}
@@ -0,0 +1,96 @@
+/*!
+ * @file advfilter.h
+ * @brief A small BPF style filter for advertising reports that can be changed at run time.
+ * @details
+ * Whether an advertising report is interesting often depends on a few bytes at an offset inside the manufacturer specific data, masked
+ * and compared against a vendor's values. Rather than writing an event condition in C for each format and reflashing, a filter program
+ * is run against each raw report in the event (nothing is copied). Programs are a list of instructions working on an accumulator A and
+ * an index register X, like BPF:
+ *
+ *     ldb k        A = data[k]                           ldbx k      A = data[X + k]
+ *     ldh k        A = data[k] | data[k+1] << 8          ldhx k      A = data[X + k] | data[X + k + 1] << 8   (little endian, as in BLE)
+ *     ldlen        A = length of the advertising data    ldrssi      A = RSSI (as an unsigned byte)
+ *     ldtype       A = advertising event type            ldaddr k    A = byte k of the device address
+ *     and k        A = A & k                             rsh k       A = A >> k
+ *     jeq k,t,f    skip t instructions if A == k, else f  (jgt, jge, and jset (A & k) != 0 likewise)
+ *     ja k         skip k instructions
+ *     find k,t,f   X = offset of the data of the first AD structure of type k (e.g., 0xFF for manufacturer data) and skip t,
+ *                  or skip f if there isn't one
+ *     ret k        accept the report if k is not 0, reject it if it is 0
+ * A load outside the report's data rejects the report. Jumps only go forward and a program has to end with ret, so the verifier
+ * (run whenever a program is loaded) can guarantee a program runs at most ADVFILTER_MAX_INSNS instructions and always ends.
+ *
+ * Programs are written in that text form, one instruction per line, with anything after ';' a comment, e.g., accept Nordic (0x0059)
+ * manufacturer data whose third byte has 0x4 in the upper nibble:
+ *     find 0xff, 0, 6
+ *     ldhx 0
+ *     jeq 0x0059, 0, 4
+ *     ldbx 2
+ *     and 0xf0
+ *     jeq 0x40, 0, 1
+ *     ret 1
+ *     ret 0
+ * advfilter_load_text assembles and loads a program from a string; with advfilter_begin(link) and advfilter_poll() in the loop, a new
+ * program can be sent over serial as those lines followed by a line with just "end" (the answer is a line starting with "FILTER OK"
+ * or "FILTER ERROR"). A line with just "clear" removes the filter. A line longer than 39 characters is answered with "FILTER ERROR"
+ * and drops the program received so far.
+ *
+ * advfilter_accepts_report decides for one report, and can be given to relay_filter_reports (see relay.h) so that only the reports that
+ * pass are relayed. advfilter_accepts is an event condition for expect_condition: it is true for an advertising report event if any of its
+ * reports passes the filter. Both accept everything when no filter is loaded.
+ *
+ * If the relay is sending frames over the same link, the answers go as relay_filter_reply records instead of lines of text, since text
+ * would corrupt the frames.
+ *
+ *  fine-print: copyright 2021 David Hamilton. This software may be freely copied and used under MIT license (see LICENSE.txt in root directory).
+ */
+
+/*
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ADVFILTER_H
+#define ADVFILTER_H
+
+#include <Arduino.h>
+#include "production.h"
+
+#define ADVFILTER_MAX_INSNS 32
+#define ADVFILTER_MAX_TEXT 512    // longest program text that can be received over serial
+
+typedef enum {af_ldb, af_ldh, af_ldbx, af_ldhx, af_ldlen, af_ldrssi, af_ldtype, af_ldaddr, af_and, af_rsh,
+              af_jeq, af_jgt, af_jge, af_jset, af_ja, af_find, af_ret, af_num_ops} advfilter_op_t;
+
+typedef struct advfilter_insn_s {
+  uint8_t op;       // advfilter_op_t
+  uint8_t jt;       // instructions to skip if true
+  uint8_t jf;       // instructions to skip if false
+  uint16_t k;
+} advfilter_insn_t;
+
+typedef struct advfilter_stats_s {
+  unsigned long reports;
+  unsigned long accepted;   // reports
+  unsigned long total_us;   // time spent running the filter
+} advfilter_stats_t;
+
+int advfilter_verify(const advfilter_insn_t * insns, int num_insns);        // index of the first bad instruction, or -1 if the program is ok
+int advfilter_assemble(const char * text, advfilter_insn_t * insns, int max_insns);  // number of instructions, or -(line number) of a bad line
+bool advfilter_run(const advfilter_insn_t * insns, le_advertising_info * report);     // the program must have been verified
+
+bool advfilter_load(const advfilter_insn_t * insns, int num_insns);  // verifies and copies the program
+bool advfilter_load_text(const char * text);
+void advfilter_clear();
+
+bool advfilter_accepts_report(le_advertising_info * report);   // the report must be within its event (see relay_advertising_reports)
+event_condition_t advfilter_accepts;
+
+void advfilter_begin(Stream * link);
+void advfilter_poll();
+
+void get_advfilter_stats(advfilter_stats_t * stats);
+void print_advfilter_stats();
+
+#endif
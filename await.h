@@ -0,0 +1,100 @@
+/*!
+ * @file await.h
+ * @brief Ready made protocol steps for common GATT operations, so that a protocol can just "await" each operation.
+ * @details
+ * Writing a new protocol usually means writing the same PERFORM, expect, and RUN_PRODUCTION lines for each operation over and over.
+ * These macros package up that pattern for the common operations, so a protocol can be written as a series of awaited operations:
+ * 
+ *     tBDAddr device_addr;
+ *     
+ *     PROTOCOL(read_battery_level)
+ *       static uint16_t connection_handle;
+ *       static read_request_t battery_level;
+ *       BEGIN_PROTOCOL(read_battery_level)
+ *         AWAIT_CONNECT(&device_addr, &connection_handle)
+ *         if (!met_expectations()) ABORT_PROTOCOL
+ *         battery_level.connection_handle = connection_handle;
+ *         battery_level.handle = 0x002A;
+ *         AWAIT_READ(&battery_level)
+ *         PRINTF("battery level: %d\n", battery_level.result.value[0])
+ *         AWAIT_DISCONNECT(&connection_handle)
+ *       END_PROTOCOL
+ * 
+ * Each AWAIT_ starts the operation and ends the current step of the protocol, so the code following it runs once that operation has 
+ * completed (just like code after RUN_PRODUCTION). Everything that has to survive from one step to the next must be static, as usual.
+ * All the arguments are pointers to that static data.
+ * 
+ * Note that only one protocol runs at a time, so these awaits are one after another within a protocol; they don't run several protocols at once.
+ * 
+ *  fine-print: copyright 2021 David Hamilton. This software may be freely copied and used under MIT license (see LICENSE.txt in root directory).
+ */
+
+/*
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef AWAIT_H
+#define AWAIT_H
+
+#include "protocol.h"
+#include "procedures.h"
+#include "get_data.h"
+#include "db.h"
+
+// addr_ptr: tBDAddr *, connection_handle_ptr: uint16_t * that gets the handle of the new connection
+#define AWAIT_CONNECT(addr_ptr, connection_handle_ptr) \
+    PERFORM(start_connection, WITH(addr_ptr)) \
+      expect_ex(le_meta_event_check, SPECIFICALLY(EVT_LE_CONN_COMPLETE), AND_DO(get_connection_handle), WITH(connection_handle_ptr)); \
+      until_event(le_meta_event_check, SPECIFICALLY(EVT_LE_CONN_COMPLETE)); \
+    RUN_PRODUCTION
+
+// connection_handle_ptr: uint16_t *, context_ptr: attribute_context_t * saying where to put the services in the device db
+#define AWAIT_DISCOVER_SERVICES(connection_handle_ptr, context_ptr) \
+    PERFORM(discover_primary_services, WITH(connection_handle_ptr)); \
+      expect_ex(ecode, EVT_BLUE_ATT_READ_BY_GROUP_TYPE_RESP, AND_DO(add_device_db_entry_from_event), WITH(context_ptr)); \
+      expect_ex(ecode, EVT_BLUE_L2CAP_CONN_UPD_REQ, AND_DO(handle_connection_update), WITH(NO_ARGS)); \
+      until_event(ecode, EVT_BLUE_GATT_PROCEDURE_COMPLETE); \
+    RUN_PRODUCTION
+
+// service_ptr: attribute_info_t * of the service, context_ptr: attribute_context_t * saying where to put the characteristics in the device db
+#define AWAIT_DISCOVER_CHARACTERISTICS(service_ptr, context_ptr) \
+    PERFORM(discover_characteristcs, WITH(service_ptr)); \
+      expect_ex(ecode, EVT_BLUE_ATT_READ_BY_TYPE_RESP, AND_DO(add_device_db_entry_from_event), WITH(context_ptr)); \
+      expect_ex(ecode, EVT_BLUE_L2CAP_CONN_UPD_REQ, AND_DO(handle_connection_update), WITH(NO_ARGS)); \
+      until_event(ecode, EVT_BLUE_GATT_PROCEDURE_COMPLETE); \
+    RUN_PRODUCTION
+
+// read_request_ptr: read_request_t * with the connection and attribute handles filled in; the value ends up in its result
+#define AWAIT_READ(read_request_ptr) \
+    PERFORM(read_characteristic_value, WITH(read_request_ptr)); \
+      expect_ex(ecode, EVT_BLUE_ATT_READ_RESP, AND_DO(get_read_response), WITH(read_request_ptr)); \
+      expect_ex(ecode, EVT_BLUE_L2CAP_CONN_UPD_REQ, AND_DO(handle_connection_update), WITH(NO_ARGS)); \
+      until_event(ecode, EVT_BLUE_GATT_PROCEDURE_COMPLETE); \
+    RUN_PRODUCTION
+
+// request_ptr: read_by_uuid_request_t * with the connection, handle range and uuid filled in; the value found ends up in its result
+#define AWAIT_READ_BY_UUID(request_ptr) \
+    PERFORM(read_using_uuid, WITH(request_ptr)); \
+      expect_ex(ecode, EVT_BLUE_GATT_DISC_READ_CHAR_BY_UUID_RESP, AND_DO(get_read_by_uuid_response), WITH(request_ptr)); \
+      expect_ex(ecode, EVT_BLUE_L2CAP_CONN_UPD_REQ, AND_DO(handle_connection_update), WITH(NO_ARGS)); \
+      until_event(ecode, EVT_BLUE_GATT_PROCEDURE_COMPLETE); \
+    RUN_PRODUCTION
+
+// sweep_ptr: sweep_read_t * filled in with set_sweep_read; the values end up in the device db
+#define AWAIT_SWEEP_READ(sweep_ptr) \
+    PERFORM(start_sweep_read, WITH(sweep_ptr)); \
+      expect_ex(ecode, EVT_BLUE_GATT_DISC_READ_CHAR_BY_UUID_RESP, AND_DO(add_sweep_read_value), WITH(sweep_ptr)); \
+      expect_ex(ecode, EVT_BLUE_GATT_PROCEDURE_COMPLETE, AND_DO(continue_sweep_read), WITH(sweep_ptr)); \
+      expect_ex(ecode, EVT_BLUE_L2CAP_CONN_UPD_REQ, AND_DO(handle_connection_update), WITH(NO_ARGS)); \
+      until(sweep_read_done); \
+    RUN_PRODUCTION
+
+// connection_handle_ptr: uint16_t * of the connection to end
+#define AWAIT_DISCONNECT(connection_handle_ptr) \
+    PERFORM(terminate_connection, WITH(connection_handle_ptr)); \
+      until_event(event_check, SPECIFICALLY(EVT_DISCONN_COMPLETE)); \
+    RUN_PRODUCTION
+
+#endif
@@ -36,6 +36,15 @@
 #include "get_data.h"
 #include "addrs.h"
 #include "db.h"
+#include "recorder.h"
+#include "coord.h"
+#include "memstat.h"
+#include "trace.h"
+#include "relay.h"
+#include "lanes.h"
+#include "advfilter.h"
+#include "metrics.h"
+#include "await.h"
 
 // Show debug messages for first 5 minutes 
 #define FIVE_MINUTES 60000 * 5
@@ -43,6 +52,30 @@
 // Number of milliseconds in a second
 #define SECONDS 1000
 
+// Define this to share the walking of devices with other scanners at the same site (see coord.h)
+//#define COORDINATE_WALKS
+#define OUR_NODE_NUMBER 1
+#define COORD_LINK Serial1
+
+// Define this to process connection and ATT events ahead of advertising reports that arrived before them (see lanes.h); costs about
+// 2 KB of RAM for the lanes, and advertising reports are dropped when their lane is full
+//#define PRIORITY_LANES
+
+// Define this to stream advertising reports to the host in binary frames (see relay.h); all debug output is then muted, since it would
+// corrupt the frames on SerialUSB.
+// All reports are sent until the host loads a filter program over the same serial link (see advfilter.h).
+//#define SNIFF_ADVERTISING
+
+// Define this to send a snapshot of the engine metrics to the host every second, in the same binary frames (see metrics.h); as with
+// SNIFF_ADVERTISING, all debug output is then muted so that the host only gets frames
+//#define EXPORT_METRICS
+
+// Define this to also read every battery level of each device walked, in as few requests as possible (see sweep reading in procedures.h)
+//#define SWEEP_BATTERY_LEVELS
+
+// Define this to print a timeline of the device walks at the end (see trace.h)
+//#define TRACE_WALKS
+
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 //
@@ -51,6 +84,7 @@
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 void set_global_expectations() {
+  expect_globally_condition(check_unexpected_reset, AND_DO(recover_from_reset), WITH(NO_ARGS));
   expect_globally_condition(check_initialization_or_reset, NO_ACTION, NO_ARGS);
   expect_globally_condition(check_event, NO_ACTION, NO_ARGS);
 }
@@ -71,6 +105,7 @@ bool process_advertising_info(hci_event_pckt *event_pckt, DUMMY_ARG) {
     if (info->bdaddr_type == PUBLIC_ADDR) add_addr(info->bdaddr, false, true);
     else add_addr(info->bdaddr, false, false);
   }
+  update_addr_rssi(info->bdaddr, info->rssi_value);
   DBADDR(DBL_IMPORTANT_EVENTS, info->bdaddr, "Device Address")
   DBPR(DBL_DECODED_EVENTS, info->rssi_value, "%d", "RSSI")
   DBPRNS(DBL_DECODED_EVENTS, info->data, info->data_length, "Advertising Data in char format");
@@ -84,9 +119,13 @@ bool process_advertising_info(hci_event_pckt *event_pckt, DUMMY_ARG) {
 //
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
+// set when a reset aborts a scan, so the scan is run again without losing the addresses it already found
+protocol_ptr_t interrupted_scan = NULL;
+
 PROTOCOL(observation_protocol)
   BEGIN_PROTOCOL(observation_protocol)
-    init_addr_list();
+    if (interrupted_scan) interrupted_scan = NULL;
+    else init_addr_list();
     PERFORM(start_HCI, WITH(NO_ARGS));
       expect(reset_reason, SPECIFICALLY(RESET_NORMAL), AND_DO(set_MAC_addr_action), WITH(NO_ARGS));
     RUN_PRODUCTION
@@ -94,6 +133,9 @@ PROTOCOL(observation_protocol)
       set_timeout(20 * SECONDS);
       PERFORM(start_observation, WITH(NO_ARGS));
         expect(event_check, SPECIFICALLY(EVT_LE_META_EVENT), AND_DO(process_advertising_info), WITH(NO_ARGS));
+        #ifdef SNIFF_ADVERTISING
+        expect(event_check, SPECIFICALLY(EVT_LE_META_EVENT), AND_DO(relay_advertising_reports), WITH(NO_ARGS));   // filtered per report
+        #endif
         until(timeout);
         PROTOCOL_IS_WORKING
     }
@@ -115,13 +157,17 @@ PROTOCOL(observation_protocol)
 
 PROTOCOL(directed_scan_protocol)
   BEGIN_PROTOCOL(directed_scan_protocol)
-    init_addr_list();
+    if (interrupted_scan) interrupted_scan = NULL;
+    else init_addr_list();
     PERFORM(start_HCI, WITH(NO_ARGS));
       expect(reset_reason, SPECIFICALLY(RESET_NORMAL), AND_DO(set_MAC_addr_action), WITH(NO_ARGS));
     RUN_PRODUCTION
     if (met_expectations()) {
       PERFORM(start_directed_scan, WITH(NO_ARGS));
         expect(event_check, SPECIFICALLY(EVT_LE_META_EVENT), AND_DO(process_advertising_info), WITH(NO_ARGS));
+        #ifdef SNIFF_ADVERTISING
+        expect(event_check, SPECIFICALLY(EVT_LE_META_EVENT), AND_DO(relay_advertising_reports), WITH(NO_ARGS));   // filtered per report
+        #endif
         until_event(procedure_complete, SPECIFICALLY(GAP_GENERAL_DISCOVERY_PROC)); 
         PROTOCOL_IS_WORKING
     }
@@ -149,13 +195,29 @@ PROTOCOL(directed_scan_protocol)
 tBDAddr addr2walk;
 uint16_t connection_handle;
 
+#ifdef SWEEP_BATTERY_LEVELS
+uuid_t battery_level_uuid = {true, {0x19, 0x2A}};
+sweep_read_t battery_sweep;
+#endif
+
+// don't leave a partial device in the db if the walk fails, and let another scanner have a go at it
+bool abandon_walk(arg_t walk_savepoint) {
+  #ifdef COORDINATE_WALKS
+  coord_walk_failed(addr2walk);
+  #endif
+  return rollback_device_db_action(walk_savepoint);
+}
+
 PROTOCOL(gatt_walk_protocol)
   evt_disconn_complete *disconnection_complete_pckt;
   static int device_index, service_index;
   bool items_todo;
   static attribute_info_t * discovery_args;
   static attribute_context_t context;
+  static db_savepoint_t walk_savepoint;
   BEGIN_PROTOCOL(gatt_walk_protocol)
+    walk_savepoint = savepoint_device_db();
+    ON_ABORT(abandon_walk, WITH(&walk_savepoint))
     PERFORM(start_connection, WITH(&addr2walk))
       expect_ex(le_meta_event_check, SPECIFICALLY(EVT_LE_CONN_COMPLETE), AND_DO(get_connection_handle), WITH(&connection_handle));
       expect_ex(procedure_complete, SPECIFICALLY(GAP_DIRECT_CONNECTION_ESTABLISHMENT_PROC), AND_DO(display_event), WITH(NO_ARGS));
@@ -233,7 +295,16 @@ PROTOCOL(gatt_walk_protocol)
     items_todo = PRIMARY_SERVICES_TODO(device_index)
     if (!items_todo) items_todo = INCLUDED_SERVICES_TODO(device_index)
     RUN_PRODUCTION_AND_REPEAT_IF(items_todo)
+    #ifdef SWEEP_BATTERY_LEVELS
+    set_sweep_read(&battery_sweep, connection_handle, &battery_level_uuid, device_index);   // the device being walked is the last in the db
+    AWAIT_SWEEP_READ(&battery_sweep)
+    print_sweep_read_savings(&battery_sweep);
+    #endif
     if (IS_PROTOCOL_WORKING) {
+      ON_ABORT(NO_ACTION, NO_ARGS)  // everything has been added to the db so keep it even if disconnecting fails
+      #ifdef COORDINATE_WALKS
+      coord_walk_done(addr2walk, savepoint_device_db() - walk_savepoint);
+      #endif
       PRINTF("terminating connection\n")
       PERFORM(terminate_connection, WITH(&connection_handle));
         expect_ex(event_check, SPECIFICALLY(EVT_DISCONN_COMPLETE), AND_DO(get_disconnection_complete), WITH(&disconnection_complete_pckt));
@@ -253,6 +324,21 @@ PROTOCOL(gatt_walk_protocol)
     PRINTF("gatt_walk_protocol ended\n");
   END_PROTOCOL 
 
+/////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// resume after an unexpected reset of the BlueNRG
+//
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+// the devices already walked are still in the device db and the partial walk was rolled back, so just walk the interrupted device again;
+// an interrupted scan is run again by main_steps (not from here, since this is called while handling the reset event)
+void resume_after_reset(protocol_ptr_t interrupted_protocol) {
+  if (interrupted_protocol == gatt_walk_protocol) addr_enumeration_retry();
+  else if ((interrupted_protocol == directed_scan_protocol) || (interrupted_protocol == observation_protocol)) {
+    interrupted_scan = interrupted_protocol;
+  }
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////
 //
 // run desired protocols
@@ -261,22 +347,62 @@ PROTOCOL(gatt_walk_protocol)
 
 STEP_FUNCTION(main_steps)
   int connectable, public_addr;
-  bool is_next_addr;
+  bool is_next_addr, rescan;
+  #ifdef COORDINATE_WALKS
+  static unsigned long claims_sent;
+  #endif
   SKIP_STEPS_IF(protocol_running())
   FIRST_STEP 
     directed_scan_protocol();
+  NEXT_STEP
+    rescan = (interrupted_scan != NULL);
+    if (rescan) (*interrupted_scan)();
+    REPEAT_STEP_WHILE(rescan)
+  #ifdef COORDINATE_WALKS
+  NEXT_STEP
+    coord_claim_all();
+    claims_sent = millis();
+  NEXT_STEP
+    REPEAT_STEP_WHILE(millis() - claims_sent < 2 * SECONDS)  // give the other nodes a chance to claim their devices too
+  #endif
   NEXT_STEP
     DB_set_lvl(9);
     addr_enumeration_start();
+    #ifdef TRACE_WALKS
+    trace_start();
+    #endif
   NEXT_STEP
     is_next_addr = addr_enumeration_next(&addr2walk, &connectable, &public_addr);
+    #ifdef COORDINATE_WALKS
+    if (is_next_addr && (connectable==1) && (public_addr==1) && coord_should_walk(addr2walk)) gatt_walk_protocol();
+    #else
     if (is_next_addr && (connectable==1) && (public_addr==1) ) gatt_walk_protocol();
+    #endif
+    REPEAT_STEP_WHILE(is_next_addr)
+  #ifdef COORDINATE_WALKS
+  NEXT_STEP
+    is_next_addr = coord_next_orphan(&addr2walk);
+    if (is_next_addr && coord_should_walk(addr2walk)) gatt_walk_protocol();
     REPEAT_STEP_WHILE(is_next_addr)
+  #endif
   NEXT_STEP
     BlueNRG_RST();   // stop processing events
     PRINTF("Devices, services, and characteristics found\n")
     dump_device_db();
     print_device_db();
+    print_reset_recovery_stats();
+    print_memory_stats();
+    print_action_timing();
+    #ifdef PRIORITY_LANES
+    print_lane_stats();
+    #endif
+    #ifdef COORDINATE_WALKS
+    print_coord_status();
+    #endif
+    #ifdef TRACE_WALKS
+    trace_stop();
+    trace_dump();
+    #endif
     PRINTF("main_steps ended\n");
 END_STEP_FUNCTION 
 
@@ -287,10 +413,28 @@ END_STEP_FUNCTION
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 void setup() {
+  memstat_paint_stack();
   SerialUSB.begin(115200);
   while (!SerialUSB);  // block until a serial monitor is opened with TinyScreen+
   DB_print_for(FIVE_MINUTES);   
   set_global_expectations();
+  on_reset_recovery(resume_after_reset);
+  BUDGET(add_device_db_entry_from_event, 2000)   // report db inserts that hold up the event callback (see print_action_timing)
+  recorder_trigger_on_abort(true);       // keep the details of what led up to a failed walk even after debug output has ended
+  recorder_trigger_on_action_failure(true);
+  recorder_start();
+  #if defined(SNIFF_ADVERTISING) || defined(EXPORT_METRICS)
+  relay_begin(&SerialUSB);
+  DB_mute(true);   // the frames share SerialUSB with debug output; relay_begin(&Serial1) instead to keep the text
+  #endif
+  #ifdef SNIFF_ADVERTISING
+  advfilter_begin(&SerialUSB);
+  relay_filter_reports(advfilter_accepts_report);
+  #endif
+  #ifdef COORDINATE_WALKS
+  COORD_LINK.begin(115200);
+  coord_begin(OUR_NODE_NUMBER, &COORD_LINK);
+  #endif
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
@@ -302,9 +446,30 @@ void setup() {
 void loop() {
   main_steps();
   HCI_Process();
+  #ifdef PRIORITY_LANES
+  lanes_drain();
+  #endif
+  run_deferred_actions();
+  recorder_poll();
+  #ifdef EXPORT_METRICS
+  metrics_poll();
+  #endif
+  #if defined(SNIFF_ADVERTISING) || defined(EXPORT_METRICS)
+  relay_poll();
+  #endif
+  #ifdef SNIFF_ADVERTISING
+  advfilter_poll();
+  #endif
+  #ifdef COORDINATE_WALKS
+  coord_poll();
+  #endif
 }
 
 void HCI_Event_CB(void *pckt) {
+  #ifdef PRIORITY_LANES
+  lanes_add(pckt);
+  #else
   run_current_protocol(pckt);
+  #endif
 }
  
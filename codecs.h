@@ -0,0 +1,255 @@
+/*!
+ * @file codecs.h
+ * @brief Decoders for standard (Bluetooth SIG) characteristic values, chosen at compile time by characteristic UUID.
+ * @details
+ * Values of standard characteristics like Heart Rate Measurement or Battery Level have a fixed format, so rather than every application
+ * taking the bytes apart by hand (usually after copying them out into a handle_value_pair_t), there is a codec for each one here that
+ * decodes straight from the event buffer into a typed struct. Each codec is a specialization of sig_codec<uuid>:
+ * 
+ *     sig_codec<SIG_BATTERY_LEVEL>::value_t level;        // battery_level_t
+ *     if (sig_codec<SIG_BATTERY_LEVEL>::decode(value, len, &level)) PRINTF("%d%%\n", level.percent)
+ * 
+ * An application lists the codecs it wants in a sig_decoder, which picks the codec for a uuid and passes the decoded struct to a handler
+ * with an operator() for each of the struct types. Only the listed codecs are compiled in, so the others cost no flash:
+ * 
+ *     typedef sig_decoder<SIG_HEART_RATE_MEASUREMENT, SIG_BATTERY_LEVEL> my_decoder;
+ *     struct my_handler {
+ *       void operator()(const heart_rate_t & hr) { PRINTF("%d bpm\n", hr.bpm) }
+ *       void operator()(const battery_level_t & level) { PRINTF("battery %d%%\n", level.percent) }
+ *     };
+ *     ...
+ *     my_handler handler;
+ *     my_decoder::decode_event(event_pckt, uuid, handler);   // notification, indication, or read response
+ * 
+ * or as an expect action (taking a pointer to the uuid as its argument; a typedef keeps the comma out of the AND_DO macro):
+ * 
+ *     #define decode_my_value sig_decode_action<my_decoder, my_handler>
+ *     expect_globally(ecode, EVT_BLUE_GATT_NOTIFICATION, AND_DO(decode_my_value), WITH(&heart_rate_uuid));
+ * 
+ * The uuid of a notification's handle can be found from the walk with characteristic_uuid16_in_device_db (see db.h); look it up once
+ * rather than for each notification. Pointers in the decoded structs (e.g., the RR intervals) point into the event, so they are only 
+ * good until the handler returns.
+ * 
+ *  fine-print: copyright 2021 David Hamilton. This software may be freely copied and used under MIT license (see LICENSE.txt in root directory).
+ */
+
+/*
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef CODECS_H
+#define CODECS_H
+
+#include <stdint.h>
+#include <STBLE.h>
+#include "production.h"
+
+#define SIG_BATTERY_LEVEL               0x2A19
+#define SIG_TEMPERATURE_MEASUREMENT     0x2A1C
+#define SIG_HEART_RATE_MEASUREMENT      0x2A37
+#define SIG_PRESSURE                    0x2A6D
+#define SIG_TEMPERATURE                 0x2A6E
+#define SIG_HUMIDITY                    0x2A6F
+
+static inline constexpr uint16_t sig_uint16(const uint8_t * p) { return p[0] | (p[1] << 8); }
+static inline constexpr uint32_t sig_uint32(const uint8_t * p) { return p[0] | (p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24); }
+
+/////////////////////////////////////////////////////////////
+// decoded values
+
+typedef struct battery_level_s {
+  uint8_t percent;
+} battery_level_t;
+
+typedef struct heart_rate_s {
+  uint16_t bpm;
+  uint8_t  sensor_contact;           // 0 or 1: not supported, 2: not detected, 3: detected
+  bool     has_energy_expended;
+  uint16_t energy_expended;          // kJ
+  uint8_t  num_rr_intervals;
+  const uint8_t * rr_intervals;      // in the event; use heart_rate_rr_interval
+} heart_rate_t;
+
+// RR interval i in 1/1024 seconds
+static inline uint16_t heart_rate_rr_interval(const heart_rate_t & hr, int i) { return sig_uint16(hr.rr_intervals + 2*i); }
+
+typedef struct temperature_measurement_s {
+  float   temperature;
+  bool    fahrenheit;
+  bool    has_timestamp;
+  const uint8_t * timestamp;         // in the event: year(2) month day hours minutes seconds
+  bool    has_type;
+  uint8_t type;                      // 1: armpit, 2: body, 3: ear, 4: finger, 5: gastro-intestinal, 6: mouth, 7: rectum, 8: toe, 9: tympanum
+} temperature_measurement_t;
+
+typedef struct temperature_s {
+  int16_t centi_celsius;
+} temperature_t;
+
+typedef struct humidity_s {
+  uint16_t centi_percent;
+} humidity_t;
+
+typedef struct pressure_s {
+  uint32_t deci_pascals;
+} pressure_t;
+
+/////////////////////////////////////////////////////////////
+// codecs; there is only a codec for the uuids specialized below
+
+template <uint16_t UUID> struct sig_codec;
+
+template <> struct sig_codec<SIG_BATTERY_LEVEL> {
+  typedef battery_level_t value_t;
+  static bool decode(const uint8_t * v, uint8_t len, value_t * out) {
+    if (len < 1) return false;
+    out->percent = v[0];
+    return true;
+  }
+};
+
+template <> struct sig_codec<SIG_HEART_RATE_MEASUREMENT> {
+  typedef heart_rate_t value_t;
+  static bool decode(const uint8_t * v, uint8_t len, value_t * out) {
+    uint8_t flags, i = 1;
+    if (len < 2) return false;
+    flags = v[0];
+    if (flags & 0x01) {
+      if (len < 3) return false;
+      out->bpm = sig_uint16(v + 1);
+      i = 3;
+    }
+    else out->bpm = v[i++];
+    out->sensor_contact = (flags >> 1) & 0x03;
+    out->has_energy_expended = (flags & 0x08) != 0;
+    if (out->has_energy_expended) {
+      if (len < i + 2) return false;
+      out->energy_expended = sig_uint16(v + i);
+      i += 2;
+    }
+    else out->energy_expended = 0;
+    out->num_rr_intervals = (flags & 0x10) ? (len - i) / 2 : 0;
+    out->rr_intervals = v + i;
+    return true;
+  }
+};
+
+template <> struct sig_codec<SIG_TEMPERATURE_MEASUREMENT> {
+  typedef temperature_measurement_t value_t;
+  // IEEE-11073 32 bit FLOAT: 24 bit signed mantissa, 8 bit signed base 10 exponent; false for NaN, infinity, etc.
+  static bool decode_float(const uint8_t * v, float * out) {
+    int32_t mantissa = v[0] | (v[1] << 8) | ((int32_t) v[2] << 16);
+    int8_t exponent = (int8_t) v[3];
+    if ((mantissa >= 0x7FFFFE) && (mantissa <= 0x800002)) return false;
+    if (mantissa & 0x800000) mantissa -= 0x1000000;
+    *out = mantissa;
+    for (; exponent > 0; exponent--) *out *= 10;
+    for (; exponent < 0; exponent++) *out /= 10;
+    return true;
+  }
+  static bool decode(const uint8_t * v, uint8_t len, value_t * out) {
+    uint8_t flags, i = 5;
+    if (len < 5) return false;
+    flags = v[0];
+    if (!decode_float(v + 1, &(out->temperature))) return false;
+    out->fahrenheit = (flags & 0x01) != 0;
+    out->has_timestamp = (flags & 0x02) != 0;
+    out->timestamp = v + i;
+    if (out->has_timestamp) i += 7;
+    out->has_type = (flags & 0x04) != 0;
+    if (out->has_type) {
+      if (len < i + 1) return false;
+      out->type = v[i];
+    }
+    return len >= i;
+  }
+};
+
+template <> struct sig_codec<SIG_TEMPERATURE> {
+  typedef temperature_t value_t;
+  static bool decode(const uint8_t * v, uint8_t len, value_t * out) {
+    if (len < 2) return false;
+    out->centi_celsius = (int16_t) sig_uint16(v);
+    return true;
+  }
+};
+
+template <> struct sig_codec<SIG_HUMIDITY> {
+  typedef humidity_t value_t;
+  static bool decode(const uint8_t * v, uint8_t len, value_t * out) {
+    if (len < 2) return false;
+    out->centi_percent = sig_uint16(v);
+    return true;
+  }
+};
+
+template <> struct sig_codec<SIG_PRESSURE> {
+  typedef pressure_t value_t;
+  static bool decode(const uint8_t * v, uint8_t len, value_t * out) {
+    if (len < 4) return false;
+    out->deci_pascals = sig_uint32(v);
+    return true;
+  }
+};
+
+/////////////////////////////////////////////////////////////
+// compile time dispatch over the codecs an application lists
+
+// where the value is in a notification, indication, or read response (no copying); false for other events
+static inline bool sig_event_value(hci_event_pckt * event_pckt, const uint8_t ** value, uint8_t * len) {
+  evt_blue_aci * evt_blue;
+  if (event_pckt->evt != EVT_VENDOR) return false;
+  evt_blue = (evt_blue_aci *) event_pckt->data;
+  switch (evt_blue->ecode) {
+    case EVT_BLUE_GATT_NOTIFICATION:
+      // event_data_length includes the attribute handle
+      if (((evt_gatt_attr_notification *) evt_blue->data)->event_data_length < 2) return false;
+      *value = ((evt_gatt_attr_notification *) evt_blue->data)->attr_value;
+      *len = ((evt_gatt_attr_notification *) evt_blue->data)->event_data_length - 2;
+      return true;
+    case EVT_BLUE_GATT_INDICATION:
+      if (((evt_gatt_indication *) evt_blue->data)->event_data_length < 2) return false;
+      *value = ((evt_gatt_indication *) evt_blue->data)->attr_value;
+      *len = ((evt_gatt_indication *) evt_blue->data)->event_data_length - 2;
+      return true;
+    case EVT_BLUE_ATT_READ_RESP:
+      *value = ((evt_att_read_resp *) evt_blue->data)->attribute_value;
+      *len = ((evt_att_read_resp *) evt_blue->data)->event_data_length;
+      return true;
+    default:
+      return false;
+  }
+}
+
+template <uint16_t... UUIDS> struct sig_decoder;
+
+template <> struct sig_decoder<> {
+  template <class HANDLER> static bool decode(uint16_t uuid, const uint8_t * value, uint8_t len, HANDLER & handler) { return false; }
+};
+
+template <uint16_t UUID, uint16_t... REST> struct sig_decoder<UUID, REST...> {
+  // false if the uuid isn't one of the listed codecs or the value doesn't decode
+  template <class HANDLER> static bool decode(uint16_t uuid, const uint8_t * value, uint8_t len, HANDLER & handler) {
+    typename sig_codec<UUID>::value_t decoded;
+    if (uuid != UUID) return sig_decoder<REST...>::decode(uuid, value, len, handler);
+    if (!sig_codec<UUID>::decode(value, len, &decoded)) return false;
+    handler(decoded);
+    return true;
+  }
+  template <class HANDLER> static bool decode_event(hci_event_pckt * event_pckt, uint16_t uuid, HANDLER & handler) {
+    const uint8_t * value;
+    uint8_t len;
+    if (!sig_event_value(event_pckt, &value, &len)) return false;
+    return decode(uuid, value, len, handler);
+  }
+};
+
+// expect action; the argument is a pointer to the uint16_t uuid of the characteristic
+template <class DECODER, class HANDLER> bool sig_decode_action(hci_event_pckt * event_pckt, arg_t uuid) {
+  HANDLER handler;
+  return DECODER::decode_event(event_pckt, *((uint16_t *) uuid), handler);
+}
+
+#endif
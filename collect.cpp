@@ -0,0 +1,100 @@
+/*!
+ * @file collect.cpp
+ * @brief Implementation of collecting one characteristic from a set of devices
+ * @details
+ * collect_protocol handles one device: get a connection from the pool (see connpool.h), read by uuid, and give the connection back. If
+ * the protocol is aborted (e.g., the connection fails), its abort action reports the device as failed so collect_next can move on to the
+ * next device.
+ * 
+ *  fine-print: copyright 2021 David Hamilton. This software may be freely copied and used under MIT license (see LICENSE.txt in root directory).
+ */
+
+/*
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "collect.h"
+#include "await.h"
+#include "connpool.h"
+#include "addrs.h"
+#include "dbprint.h"
+
+static tBDAddr * collect_devices;
+static int num_collect_devices = 0;
+static int next_collect_device = 0;
+static collect_result_t * collect_result = NULL;
+static tBDAddr collect_addr;
+static read_by_uuid_request_t collect_request;
+static pooled_connection_t collect_link;
+static unsigned long device_started;
+static collect_stats_t stats;
+
+void collect_start(tBDAddr * devices, int num_devices, uuid_t * uuid, collect_result_t * on_result) {
+  collect_devices = devices;
+  num_collect_devices = num_devices;
+  next_collect_device = 0;
+  collect_result = on_result;
+  copy_uuid(uuid, &(collect_request.uuid));
+  collect_request.start_handle = 0x0001;
+  collect_request.end_handle = 0xFFFF;
+  memset(&stats, 0, sizeof(stats));
+}
+
+bool collect_next() {
+  if (next_collect_device >= num_collect_devices) return false;
+  copy_addr(collect_devices[next_collect_device++], &collect_addr);
+  collect_protocol();
+  return true;
+}
+
+static void device_done(bool succeeded) {
+  unsigned long ms = millis() - device_started;
+  stats.devices++;
+  if (succeeded) stats.succeeded++;
+  else stats.failed++;
+  stats.total_ms += ms;
+  if (ms > stats.max_ms) stats.max_ms = ms;
+}
+
+// abort action
+static bool collect_failed(arg_t dummy) {
+  connpool_drop_on_abort(&collect_link);
+  if (collect_result) (*collect_result)(&collect_addr, NULL);
+  device_done(false);
+  return true;
+}
+
+// event action: pass on each value as it arrives
+static bool stream_collected_value(hci_event_pckt *event_pckt, arg_t request) {
+  if (!get_read_by_uuid_response(event_pckt, request)) return false;
+  if (collect_result) (*collect_result)(&collect_addr, &(collect_request.result));
+  return true;
+}
+
+PROTOCOL(collect_protocol)
+  BEGIN_PROTOCOL(collect_protocol)
+    device_started = millis();
+    ON_ABORT(collect_failed, NO_ARGS)
+    AWAIT_POOLED_CONNECT(&collect_link, &collect_addr)
+    if (!collect_link.connected) ABORT_PROTOCOL
+    collect_request.connection_handle = collect_link.connection_handle;
+    PERFORM(read_using_uuid, WITH(&collect_request));
+      expect_ex(ecode, EVT_BLUE_GATT_DISC_READ_CHAR_BY_UUID_RESP, AND_DO(stream_collected_value), WITH(&collect_request));
+      expect_ex(ecode, EVT_BLUE_L2CAP_CONN_UPD_REQ, AND_DO(handle_connection_update), WITH(NO_ARGS));
+      until_event(ecode, EVT_BLUE_GATT_PROCEDURE_COMPLETE);
+    RUN_PRODUCTION
+    // from here on the device has been handled one way or the other, so don't report it again if disconnecting fails
+    ON_ABORT(NO_ACTION, NO_ARGS)
+    if ((collect_request.num_results == 0) && collect_result) (*collect_result)(&collect_addr, NULL);
+    device_done(collect_request.num_results > 0);
+    AWAIT_POOLED_RELEASE(&collect_link)
+  END_PROTOCOL
+
+void get_collect_stats(collect_stats_t * s) { *s = stats; }
+
+void print_collect_stats() {
+  PRINTF("collect: %d devices, %d succeeded, %d failed, ", stats.devices, stats.succeeded, stats.failed)
+  PRINTF("avg %lu ms, max %lu ms per device\n", stats.devices ? stats.total_ms / stats.devices : 0, stats.max_ms)
+}
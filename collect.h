@@ -0,0 +1,63 @@
+/*!
+ * @file collect.h
+ * @brief Collect the value of one characteristic (e.g., battery level or firmware revision) from each of a set of devices.
+ * @details
+ * Walking the whole GATT of every device just to get one value from each takes a connection plus a discovery request per service and
+ * characteristic. Collecting instead does, for each device: connect, one ATT read by UUID (which finds and reads the characteristic in a
+ * single request, without any discovery), and disconnect. Connections come from the connection pool (see connpool.h), so collecting from
+ * the same devices again soon after (e.g., polling battery levels) reuses the links instead of reconnecting; call connpool_close_idle()
+ * when no protocol is running to close the links that aren't worth keeping. Each value is passed to a callback as soon as it arrives, so results stream
+ * out while the rest of the devices are still being collected.
+ * 
+ * Typical usage (with protocols gated by protocol_running() as in the main sketch's STEP_FUNCTION):
+ *     void show_battery_level(tBDAddr * addr, handle_value_pair_t * value) {
+ *       print_addr(*addr);
+ *       if (value) PRINTF(" battery level %d\n", value->value[0])
+ *       else PRINTF(" could not be read\n")
+ *     }
+ *     ...
+ *     battery_level_uuid.is_16_bit = true;
+ *     battery_level_uuid.bytes[0] = 0x19;
+ *     battery_level_uuid.bytes[1] = 0x2A;
+ *     collect_start(devices, num_devices, &battery_level_uuid, show_battery_level);
+ *   NEXT_STEP
+ *     REPEAT_STEP_WHILE(collect_next())
+ * 
+ * Only one protocol runs at a time (see protocol.h), so devices are collected one after another rather than several at once.
+ * 
+ *  fine-print: copyright 2021 David Hamilton. This software may be freely copied and used under MIT license (see LICENSE.txt in root directory).
+ */
+
+/*
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef COLLECT_H
+#define COLLECT_H
+
+#include "protocol.h"
+#include "get_data.h"
+
+// called for each value read (a device can have more than one characteristic with the uuid), or with value NULL if a device couldn't be read
+typedef void (collect_result_t)(tBDAddr * addr, handle_value_pair_t * value);
+
+typedef struct collect_stats_s {
+  int devices;
+  int succeeded;
+  int failed;
+  unsigned long total_ms;
+  unsigned long max_ms;      // longest time for one device, from starting to connect to having the value
+} collect_stats_t;
+
+// devices must stay around until collecting is done
+void collect_start(tBDAddr * devices, int num_devices, uuid_t * uuid, collect_result_t * on_result);
+bool collect_next();   // starts collecting from the next device and returns true, or returns false when all devices are done
+
+protocol_t collect_protocol;
+
+void get_collect_stats(collect_stats_t * stats);
+void print_collect_stats();
+
+#endif
@@ -0,0 +1,229 @@
+/*!
+ * @file connpool.cpp
+ * @brief Implementation of the connection pool
+ * @details
+ * The pool is a fixed table of devices. An entry stays in the table after its link is closed so that its setup time and time between
+ * uses are still known the next time; when the table is full, the least recently used device without an open link is forgotten.
+ * Links are dropped from the pool as soon as the pool decides to close them (before the disconnection completes), so a link being
+ * closed is never handed out again and connpool_disconnected only counts links the other side ended.
+ *
+ *  fine-print: copyright 2021 David Hamilton. This software may be freely copied and used under MIT license (see LICENSE.txt in root directory).
+ */
+
+/*
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "connpool.h"
+#include "addrs.h"
+#include "dbprint.h"
+
+static connpool_entry_t entries[CONNPOOL_DEVICES];
+static int num_entries = 0;
+static connpool_entry_t * connecting = NULL;
+static unsigned long connect_started;
+static uint16_t closing_handle;
+static connpool_stats_t stats;
+
+// averages move a quarter of the way to each new sample
+#define AVERAGE_IN(avg, sample) ((3 * (avg) + (sample)) / 4)
+
+static connpool_entry_t * find_device(tBDAddr * addr) {
+  for (int i = 0; i < num_entries; i++) {
+    if (addrs_match(entries[i].addr, *addr)) return &(entries[i]);
+  }
+  return NULL;
+}
+
+static connpool_entry_t * find_link(uint16_t connection_handle) {
+  for (int i = 0; i < num_entries; i++) {
+    if (entries[i].open && (entries[i].connection_handle == connection_handle)) return &(entries[i]);
+  }
+  return NULL;
+}
+
+static int num_open() {
+  int n = 0;
+  for (int i = 0; i < num_entries; i++) {
+    if (entries[i].open) n++;
+  }
+  return n;
+}
+
+static connpool_entry_t * new_device(tBDAddr * addr) {
+  connpool_entry_t * entry = NULL;
+  if (num_entries < CONNPOOL_DEVICES) entry = &(entries[num_entries++]);
+  else {
+    for (int i = 0; i < num_entries; i++) {
+      if (entries[i].open || entries[i].in_use) continue;
+      if (!entry || (millis() - entries[i].last_used > millis() - entry->last_used)) entry = &(entries[i]);
+    }
+    if (!entry) {
+      DBMSG(DBL_ERRORS, "*** connection pool has no room for another device")
+      return NULL;
+    }
+  }
+  memset(entry, 0, sizeof(connpool_entry_t));
+  copy_addr(*addr, &(entry->addr));
+  return entry;
+}
+
+static void note_use(connpool_entry_t * entry) {
+  unsigned long now = millis();
+  if (entry->uses == 1) entry->mean_gap_ms = now - entry->last_used;
+  else if (entry->uses > 1) entry->mean_gap_ms = AVERAGE_IN(entry->mean_gap_ms, now - entry->last_used);
+  entry->uses++;
+  entry->last_used = now;
+}
+
+unsigned long connpool_keep_alive_ms(connpool_entry_t * entry) {
+  unsigned long setup_ms = entry->setup_ms ? entry->setup_ms : CONNPOOL_DEFAULT_SETUP_MS;
+  return setup_ms * CONNPOOL_EVENTS_PER_MS_SAVED * CONNPOOL_IDLE_INTERVAL_MS;
+}
+
+bool connpool_get(tBDAddr * addr, uint16_t * connection_handle) {
+  connpool_entry_t * entry = find_device(addr);
+  stats.gets++;
+  if (!entry || !entry->open || entry->in_use) return false;
+  stats.hits++;
+  stats.saved_ms += entry->setup_ms;
+  note_use(entry);
+  entry->in_use = true;
+  *connection_handle = entry->connection_handle;
+  DBADDR(DBL_HAL_EVENTS, entry->addr, "reusing pooled connection for")
+  return true;
+}
+
+bool connpool_make_room(uint16_t * evict_handle) {
+  connpool_entry_t * lru = NULL;
+  if (num_open() < CONNPOOL_LINKS) return false;
+  for (int i = 0; i < num_entries; i++) {
+    if (!entries[i].open || entries[i].in_use) continue;
+    if (!lru || (millis() - entries[i].last_used > millis() - lru->last_used)) lru = &(entries[i]);
+  }
+  if (!lru) {
+    DBMSG(DBL_WARNINGS, "all pooled connections are in use, connecting without evicting one")
+    return false;
+  }
+  lru->open = false;
+  stats.evictions++;
+  *evict_handle = lru->connection_handle;
+  DBADDR(DBL_HAL_EVENTS, lru->addr, "evicting pooled connection for")
+  return true;
+}
+
+void connpool_connecting(tBDAddr * addr) {
+  connecting = find_device(addr);
+  if (!connecting) connecting = new_device(addr);
+  if (connecting) note_use(connecting);
+  connect_started = millis();
+}
+
+bool connpool_connection_complete(hci_event_pckt *event_pckt, arg_t pooled_arg) {
+  pooled_connection_t * pooled = (pooled_connection_t *) pooled_arg;
+  unsigned long setup_ms = millis() - connect_started;
+  pooled->connected = get_connection_handle(event_pckt, &(pooled->connection_handle));
+  if (!connecting) return pooled->connected;
+  if (!pooled->connected) {
+    connecting = NULL;
+    return false;
+  }
+  connecting->setup_ms = connecting->setup_ms ? AVERAGE_IN(connecting->setup_ms, setup_ms) : setup_ms;
+  connecting->connection_handle = pooled->connection_handle;
+  connecting->open = true;
+  connecting->in_use = true;
+  connecting = NULL;
+  return true;
+}
+
+bool connpool_release(uint16_t connection_handle) {
+  connpool_entry_t * entry = find_link(connection_handle);
+  if (!entry) return true;
+  entry->in_use = false;
+  entry->last_used = millis();
+  if ((entry->uses > 1) && (entry->mean_gap_ms > connpool_keep_alive_ms(entry))) {
+    entry->open = false;
+    stats.closed_on_release++;
+    return true;
+  }
+  stats.kept++;
+  return false;
+}
+
+bool connpool_drop_on_abort(arg_t pooled_arg) {
+  pooled_connection_t * pooled = (pooled_connection_t *) pooled_arg;
+  connpool_entry_t * entry;
+  if (!pooled->connected) return true;
+  pooled->connected = false;
+  // the link may be why the protocol failed, so it isn't handed out again
+  entry = find_link(pooled->connection_handle);
+  if (entry) {
+    entry->open = false;
+    entry->in_use = false;
+    entry->last_used = millis();
+    stats.dropped_on_abort++;
+  }
+  // there is no protocol step left to wait for the disconnection in, so just start it
+  terminate_connection(&(pooled->connection_handle));
+  return true;
+}
+
+bool connpool_idle_link(uint16_t * connection_handle) {
+  for (int i = 0; i < num_entries; i++) {
+    connpool_entry_t * entry = &(entries[i]);
+    if (!entry->open || entry->in_use) continue;
+    unsigned long limit = connpool_keep_alive_ms(entry);
+    // a device that is overdue probably isn't coming back soon
+    if ((entry->uses > 1) && (2 * entry->mean_gap_ms < limit)) limit = 2 * entry->mean_gap_ms;
+    if (millis() - entry->last_used > limit) {
+      entry->open = false;
+      stats.idle_closes++;
+      *connection_handle = entry->connection_handle;
+      DBADDR(DBL_HAL_EVENTS, entry->addr, "closing idle pooled connection for")
+      return true;
+    }
+  }
+  return false;
+}
+
+bool connpool_disconnected(hci_event_pckt *event_pckt, DUMMY_ARG) {
+  evt_disconn_complete * disconnection;
+  get_disconnection_complete(event_pckt, &disconnection);
+  if (!disconnection) return false;
+  connpool_entry_t * entry = find_link(disconnection->handle);
+  if (entry) {
+    entry->open = false;
+    entry->in_use = false;
+    stats.remote_closes++;
+    DBADDR(DBL_IMPORTANT_EVENTS, entry->addr, "pooled connection was ended by")
+  }
+  return true;
+}
+
+PROTOCOL(connpool_close_protocol)
+  BEGIN_PROTOCOL(connpool_close_protocol)
+    AWAIT_DISCONNECT(&closing_handle)
+  END_PROTOCOL
+
+bool connpool_close_idle() {
+  if (protocol_running()) return false;
+  if (!connpool_idle_link(&closing_handle)) return false;
+  connpool_close_protocol();
+  return true;
+}
+
+void get_connpool_stats(connpool_stats_t * s) { *s = stats; }
+
+void print_connpool_stats() {
+  PRINTF("connpool: %d gets, %d hits (%d%%), %lu ms of connection setup saved\n", stats.gets, stats.hits,
+         stats.gets ? (100 * stats.hits) / stats.gets : 0, stats.saved_ms)
+  PRINTF("connpool: kept %d, closed on release %d, evicted %d, closed idle %d, ended by device %d, dropped on abort %d\n", stats.kept,
+         stats.closed_on_release, stats.evictions, stats.idle_closes, stats.remote_closes, stats.dropped_on_abort)
+  for (int i = 0; i < num_entries; i++) {
+    print_addr(entries[i].addr);
+    PRINTF(" %s setup %lu ms, %d uses, every %lu ms, keep alive %lu ms\n", entries[i].open ? "open  " : "closed", entries[i].setup_ms,
+           entries[i].uses, entries[i].mean_gap_ms, connpool_keep_alive_ms(&(entries[i])))
+  }
+}
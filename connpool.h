@@ -0,0 +1,134 @@
+/*!
+ * @file connpool.h
+ * @brief Keeps recently used connections open so going back to the same device doesn't have to reconnect.
+ * @details
+ * Setting up a connection (the connection request, waiting for the device's next advertisement, and the connection complete) takes
+ * hundreds of milliseconds, often more than the reads done over it. When an application goes back to the same devices again and again
+ * (e.g., polling sensors), keeping the links open in between saves that every time, but each open link costs a connection event every
+ * connection interval even when idle, and the controller can only have a few links open.
+ *
+ * The pool keeps up to CONNPOOL_LINKS links open. It remembers, for each device, the average time it took to connect and the average
+ * time between uses, and weighs the two when a device is released:
+ *  - reconnecting next time costs the setup time (ms of latency)
+ *  - keeping the link open costs one idle connection event per CONNPOOL_IDLE_INTERVAL_MS until the next use
+ *  - CONNPOOL_EVENTS_PER_MS_SAVED says how many idle connection events are worth spending to save one ms of setup latency
+ * So a link is kept open for up to setup_ms * CONNPOOL_EVENTS_PER_MS_SAVED * CONNPOOL_IDLE_INTERVAL_MS after it was last used (its
+ * keep-alive horizon). A device that is used less often than that is disconnected right away when released, and a kept link is
+ * closed when it has been idle longer than its horizon or for more than twice its usual time between uses. If the pool is full when
+ * a new link is needed, the least recently used idle link is closed to make room.
+ *
+ * Typical usage in a protocol:
+ *     static pooled_connection_t link;
+ *     PROTOCOL(read_battery_protocol)
+ *       BEGIN_PROTOCOL(read_battery_protocol)
+ *         ON_ABORT(connpool_drop_on_abort, WITH(&link))
+ *         AWAIT_POOLED_CONNECT(&link, &device_addr)
+ *         if (!link.connected) ABORT_PROTOCOL
+ *         battery_level.connection_handle = link.connection_handle;
+ *         AWAIT_READ(&battery_level)
+ *         AWAIT_POOLED_RELEASE(&link)
+ *       END_PROTOCOL
+ * and, when no protocol is running (e.g., in the main sketch's STEP_FUNCTION), connpool_close_idle() to close links whose time is up.
+ * Links the other side drops are noticed with expect_globally(event_check, EVT_DISCONN_COMPLETE, connpool_disconnected, NO_ARGS).
+ *
+ *  fine-print: copyright 2021 David Hamilton. This software may be freely copied and used under MIT license (see LICENSE.txt in root directory).
+ */
+
+/*
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef CONNPOOL_H
+#define CONNPOOL_H
+
+#include "await.h"
+
+#define CONNPOOL_LINKS 4                 // the BlueNRG-MS allows up to 8 links; leave some for connections outside the pool (e.g., walks)
+#define CONNPOOL_DEVICES 16              // devices whose setup time and time between uses are remembered
+#define CONNPOOL_IDLE_INTERVAL_MS 50     // the connection interval start_connection asks for (40 * 1.25 ms)
+#define CONNPOOL_EVENTS_PER_MS_SAVED 1   // idle connection events worth spending to save one ms of connection setup
+#define CONNPOOL_DEFAULT_SETUP_MS 200    // assumed setup time for a device that hasn't been connected to yet
+
+typedef struct connpool_entry_s {
+  tBDAddr addr;
+  uint16_t connection_handle;
+  bool open;
+  bool in_use;                  // between getting the link and releasing it
+  unsigned long last_used;      // millis when last got or released
+  unsigned long setup_ms;       // average time to connect
+  unsigned long mean_gap_ms;    // average time from one release to the next use, 0 until the device has been used twice
+  int uses;
+} connpool_entry_t;
+
+typedef struct connpool_stats_s {
+  int gets;
+  int hits;                     // gets that found the link already open
+  int evictions;                // links closed to make room for another
+  int kept;                     // releases that kept the link open
+  int closed_on_release;        // releases where reconnecting later was cheaper than keeping the link
+  int idle_closes;              // kept links closed by connpool_close_idle
+  int remote_closes;            // pooled links the other side (or supervision timeout) ended
+  int dropped_on_abort;         // links disconnected because the protocol using them failed
+  unsigned long saved_ms;       // connection setup time saved by hits
+} connpool_stats_t;
+
+// the state of one pooled connection for the AWAIT_POOLED_ macros; must be static
+typedef struct pooled_connection_s {
+  tBDAddr * addr;
+  uint16_t connection_handle;
+  uint16_t evict_handle;
+  bool hit;
+  bool evict;
+  bool connected;
+  bool close;
+} pooled_connection_t;
+
+bool connpool_get(tBDAddr * addr, uint16_t * connection_handle);  // true on a hit, with the handle of the open link
+bool connpool_make_room(uint16_t * evict_handle);  // true if a link has to be closed first, with its handle (it is dropped from the pool)
+void connpool_connecting(tBDAddr * addr);          // starts timing the connection setup
+bool connpool_release(uint16_t connection_handle); // true if the link should be disconnected now (it is then dropped from the pool)
+bool connpool_drop_on_abort(arg_t pooled);         // pooled_connection_t *; usable as an ON_ABORT action: drops the link from the pool and disconnects it
+bool connpool_idle_link(uint16_t * connection_handle); // true if a kept link has been idle too long, with its handle (it is dropped)
+unsigned long connpool_keep_alive_ms(connpool_entry_t * entry);
+
+event_action_t connpool_connection_complete;  // arg: pooled_connection_t *; for EVT_LE_CONN_COMPLETE
+event_action_t connpool_disconnected;         // for EVT_DISCONN_COMPLETE, forgets the link if it was pooled
+
+protocol_t connpool_close_protocol;
+bool connpool_close_idle();   // starts connpool_close_protocol and returns true if a link is due to be closed; call when no protocol is running
+
+void get_connpool_stats(connpool_stats_t * stats);
+void print_connpool_stats();
+
+// gets an open link to the device from the pool, or connects to it (closing the least recently used idle link first if the pool is full)
+#define AWAIT_POOLED_CONNECT(pooled_ptr, addr_ptr) \
+    (pooled_ptr)->addr = (addr_ptr); \
+    (pooled_ptr)->hit = connpool_get((pooled_ptr)->addr, &((pooled_ptr)->connection_handle)); \
+    (pooled_ptr)->connected = (pooled_ptr)->hit; \
+    (pooled_ptr)->evict = !(pooled_ptr)->hit && connpool_make_room(&((pooled_ptr)->evict_handle)); \
+    if ((pooled_ptr)->evict) { \
+      PERFORM(terminate_connection, WITH(&((pooled_ptr)->evict_handle))) \
+        until_event(event_check, SPECIFICALLY(EVT_DISCONN_COMPLETE)); \
+    } \
+    RUN_PRODUCTION_UNLESS(!(pooled_ptr)->evict) \
+    if (!(pooled_ptr)->hit) { \
+      connpool_connecting((pooled_ptr)->addr); \
+      PERFORM(start_connection, WITH((pooled_ptr)->addr)) \
+        expect_ex(le_meta_event_check, SPECIFICALLY(EVT_LE_CONN_COMPLETE), AND_DO(connpool_connection_complete), WITH(pooled_ptr)); \
+        until_event(le_meta_event_check, SPECIFICALLY(EVT_LE_CONN_COMPLETE)); \
+    } \
+    RUN_PRODUCTION_UNLESS((pooled_ptr)->hit)
+
+// gives the link back to the pool, which either keeps it open or disconnects it now
+#define AWAIT_POOLED_RELEASE(pooled_ptr) \
+    (pooled_ptr)->close = connpool_release((pooled_ptr)->connection_handle); \
+    (pooled_ptr)->connected = false; \
+    if ((pooled_ptr)->close) { \
+      PERFORM(terminate_connection, WITH(&((pooled_ptr)->connection_handle))) \
+        until_event(event_check, SPECIFICALLY(EVT_DISCONN_COMPLETE)); \
+    } \
+    RUN_PRODUCTION_UNLESS(!(pooled_ptr)->close)
+
+#endif
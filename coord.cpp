@@ -0,0 +1,224 @@
+/*!
+ * @file coord.cpp
+ * @brief Implementation of coordination between several scanners
+ * @details
+ * Lease information is kept per entry in the address list (see addrs.h), so only devices this node has heard itself are tracked;
+ * claims for anything else are ignored since this node couldn't walk them anyway.
+ * 
+ *  fine-print: copyright 2021 David Hamilton. This software may be freely copied and used under MIT license (see LICENSE.txt in root directory).
+ */
+
+/*
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "coord.h"
+#include "dbprint.h"
+
+#define NO_NODE 0xFF
+
+typedef struct lease_s {
+  uint8_t holder;           // node with the best claim heard so far
+  int8_t  holder_rssi;
+  unsigned long expires;
+  bool    done;             // walked by somebody
+  uint8_t done_by;
+  int     num_records;
+} lease_t;
+
+static lease_t leases[MAX_ADDRS];
+static uint8_t our_node = NO_NODE;
+static Stream * coord_link = NULL;
+static int active_lease = -1;     // index of the device we are walking
+static unsigned long last_renewal = 0;
+
+static char line[COORD_MAX_LINE];       // incoming
+static int line_len = 0;
+static char message[COORD_MAX_LINE];    // outgoing
+
+void coord_begin(uint8_t node, Stream * link) {
+  int i;
+  our_node = node;
+  coord_link = link;
+  active_lease = -1;
+  line_len = 0;
+  for (i=0; i<MAX_ADDRS; i++) {
+    leases[i].holder = NO_NODE;
+    leases[i].done = false;
+  }
+}
+
+/*
+ * messages
+ */
+
+static void send_message(const char * type, tBDAddr addr, int value) {
+  int len;
+  if (!coord_link) return;
+  len = snprintf(message, COORD_MAX_LINE, "%s %u %02X%02X%02X%02X%02X%02X %d\n", type, our_node, addr[5], addr[4], addr[3], addr[2], addr[1], addr[0], value);
+  coord_link->write((const uint8_t *) message, len);
+}
+
+static bool parse_addr(const char * hex, tBDAddr * addr) {
+  int i;
+  unsigned int byte;
+  for (i=0; i<6; i++) {
+    if (sscanf(hex + 2*i, "%2X", &byte) != 1) return false;
+    (*addr)[5-i] = byte;
+  }
+  return true;
+}
+
+// true if the first claim beats the second
+static bool better_claim(int8_t rssi1, uint8_t node1, int8_t rssi2, uint8_t node2) {
+  if (rssi1 != rssi2) return (rssi1 > rssi2);
+  return (node1 < node2);
+}
+
+static bool lease_expired(lease_t * lease) {
+  return ((lease->holder == NO_NODE) || ((long) (millis() - lease->expires) > 0));
+}
+
+static void take_claim(int index, uint8_t node, int8_t rssi) {
+  leases[index].holder = node;
+  leases[index].holder_rssi = rssi;
+  leases[index].expires = millis() + COORD_LEASE_MS;
+}
+
+static void process_message() {
+  char type[8], hex[16];
+  unsigned int node;
+  int value, index;
+  tBDAddr addr;
+  lease_t * lease;
+  if (sscanf(line, "%7s %u %15s %d", type, &node, hex, &value) != 4) {
+    DBMSG(DBL_WARNINGS, "ignoring malformed coordination message")
+    return;
+  }
+  if ((node == our_node) || !parse_addr(hex, &addr)) return;
+  index = find_addr(addr);
+  if (index < 0) return;
+  lease = &(leases[index]);
+  if (strcmp(type, "CLAIM") == 0) {
+    // once a walk has started it isn't given up, even if a better placed node shows up
+    if (lease->done || (active_lease == index)) return;
+    if (lease_expired(lease) || (lease->holder == node) || better_claim(value, node, lease->holder_rssi, lease->holder)) {
+      take_claim(index, node, value);
+    }
+  }
+  else if (strcmp(type, "DONE") == 0) {
+    lease->done = true;
+    lease->done_by = node;
+    lease->num_records = value;
+    DBADDR(DBL_IMPORTANT_EVENTS, addr, "walked by another node")
+  }
+}
+
+void coord_poll() {
+  int c;
+  tBDAddr addr;
+  if (!coord_link) return;
+  while (coord_link->available() > 0) {
+    c = coord_link->read();
+    if (c == '\n') {
+      line[line_len] = 0;
+      if (line_len > 0) process_message();
+      line_len = 0;
+    }
+    else if (line_len < COORD_MAX_LINE - 1) line[line_len++] = c;
+  }
+  if ((millis() - last_renewal) > COORD_RENEW_MS) {
+    // renew every claim we still hold, not just the walk in progress, or the devices waiting their turn would go to worse placed nodes
+    for (int index = 0; index < num_addrs_in_list(); index++) {
+      if ((leases[index].holder != our_node) || leases[index].done) continue;
+      get_addr(index, &addr);
+      take_claim(index, our_node, get_addr_rssi(index));
+      send_message("CLAIM", addr, get_addr_rssi(index));
+    }
+    last_renewal = millis();
+  }
+}
+
+/*
+ * decisions
+ */
+
+void coord_claim_all() {
+  int connectable, public_addr, index;
+  tBDAddr addr;
+  addr_enumeration_start();
+  while (addr_enumeration_next(&addr, &connectable, &public_addr)) {
+    if ((connectable != 1) || (public_addr != 1)) continue;
+    index = find_addr(addr);
+    if (leases[index].done) continue;
+    if (lease_expired(&(leases[index])) || better_claim(get_addr_rssi(index), our_node, leases[index].holder_rssi, leases[index].holder)) {
+      take_claim(index, our_node, get_addr_rssi(index));
+      send_message("CLAIM", addr, get_addr_rssi(index));
+    }
+  }
+}
+
+bool coord_should_walk(tBDAddr addr) {
+  int index = find_addr(addr);
+  lease_t * lease;
+  if (index < 0) return false;
+  coord_poll();
+  lease = &(leases[index]);
+  if (lease->done) return false;
+  if (!lease_expired(lease) && (lease->holder != our_node)) {
+    DBADDR(DBL_IMPORTANT_EVENTS, addr, "leaving device to a better placed node")
+    return false;
+  }
+  take_claim(index, our_node, get_addr_rssi(index));
+  send_message("CLAIM", addr, get_addr_rssi(index));
+  active_lease = index;
+  last_renewal = millis();
+  return true;
+}
+
+void coord_walk_done(tBDAddr addr, int num_records) {
+  int index = find_addr(addr);
+  if (index < 0) return;
+  leases[index].done = true;
+  leases[index].done_by = our_node;
+  leases[index].num_records = num_records;
+  if (active_lease == index) active_lease = -1;
+  send_message("DONE", addr, num_records);
+}
+
+void coord_walk_failed(tBDAddr addr) {
+  int index = find_addr(addr);
+  if (index < 0) return;
+  // stop renewing the claim so that it runs out and the other nodes see an orphan
+  leases[index].holder = NO_NODE;
+  if (active_lease == index) active_lease = -1;
+}
+
+bool coord_next_orphan(tBDAddr * addr) {
+  int index;
+  coord_poll();
+  for (index = 0; index < num_addrs_in_list(); index++) {
+    if (!leases[index].done && (leases[index].holder != NO_NODE) && (leases[index].holder != our_node) && lease_expired(&(leases[index]))) {
+      get_addr(index, addr);
+      PRINTF("node %u stalled, taking over its device\n", leases[index].holder)
+      return true;
+    }
+  }
+  return false;
+}
+
+void print_coord_status() {
+  int index;
+  tBDAddr addr;
+  PRINTF("\n------------------- WALKS AT THIS SITE ------------------\n");
+  for (index = 0; index < num_addrs_in_list(); index++) {
+    if (leases[index].holder == NO_NODE) continue;
+    get_addr(index, &addr);
+    print_addr(addr);
+    if (leases[index].done) PRINTF("   walked by node %u (%d records)\n", leases[index].done_by, leases[index].num_records)
+    else PRINTF("   claimed by node %u (rssi %d)\n", leases[index].holder, leases[index].holder_rssi)
+  }
+  PRINTF("==================== END OF WALKS =======================\n"); 
+}
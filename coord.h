@@ -0,0 +1,58 @@
+/*!
+ * @file coord.h
+ * @brief Coordination between several scanners at one site so that each device is walked only once, by the scanner best placed to reach it.
+ * @details
+ * Without coordination, every scanner walks every connectable device it finds, multiplying the connection load on the peripherals. With
+ * coordination, scanners (nodes) exchange short text messages over a shared link (any Arduino Stream, e.g., a UART bus between the nodes or
+ * a USB serial port relayed by a host):
+ * 
+ *     CLAIM <node> <address> <rssi>     - node wants to walk address, having seen it with the given (best) RSSI
+ *     DONE  <node> <address> <records>  - node finished walking address, adding the given number of records to its device db
+ * 
+ * A claim is a lease that lasts COORD_LEASE_MS unless it is renewed. The node with the strongest RSSI wins (ties go to the lower node number).
+ * Each node renews all the claims it holds every COORD_RENEW_MS from coord_poll, so if a node stalls (or goes away), its leases run out
+ * and the devices become orphans that the next best node picks up. A node that fails to walk a device calls coord_walk_failed, which
+ * stops renewing that claim, e.g., from the walk's ON_ABORT action.
+ * 
+ * Typical usage:
+ *     coord_begin(node_number, &Serial1);
+ *     ... scan, calling update_addr_rssi for every advertising report (see addrs.h)
+ *     coord_claim_all();
+ *     ... for each address: if (coord_should_walk(addr)) walk it, then coord_walk_done(addr, records_added) or coord_walk_failed(addr)
+ *     ... while (coord_next_orphan(&addr)) walk it, then coord_walk_done(addr, records_added)
+ * and call coord_poll() from loop().
+ * 
+ * Note that the winner is decided by the claims heard so far, so claims should be exchanged (coord_claim_all, then polling for a bit)
+ * before starting to walk.
+ * 
+ *  fine-print: copyright 2021 David Hamilton. This software may be freely copied and used under MIT license (see LICENSE.txt in root directory).
+ */
+
+/*
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef COORD_H
+#define COORD_H
+
+#include <Arduino.h>
+#include "addrs.h"
+
+#define COORD_LEASE_MS 15000
+#define COORD_RENEW_MS 5000
+#define COORD_MAX_LINE 40
+
+void coord_begin(uint8_t node, Stream * link);
+void coord_poll();
+
+void coord_claim_all();                 // claim every connectable public address in the address list
+bool coord_should_walk(tBDAddr addr);   // true if this node holds (or can take) the lease; the lease is then renewed until done
+void coord_walk_done(tBDAddr addr, int num_records);
+void coord_walk_failed(tBDAddr addr);   // gives the lease up so that another node can take the device
+bool coord_next_orphan(tBDAddr * addr); // a device that nobody finished and whose lease ran out
+
+void print_coord_status();
+
+#endif
@@ -78,6 +78,24 @@ void put_back_entry_in_device_db() {
   num_records--; 
 }
 
+db_savepoint_t savepoint_device_db() {
+  return num_records;
+}
+
+void rollback_device_db(db_savepoint_t savepoint) {
+  if ((savepoint < 0) || (savepoint > num_records)) {
+    DBPR(DBL_ERRORS, savepoint, "%d", "*** invalid device db savepoint")
+    return;
+  }
+  DBPR(DBL_IMPORTANT_EVENTS, num_records - savepoint, "%d", "device db records rolled back")
+  num_records = savepoint;
+}
+
+bool rollback_device_db_action(arg_t savepoint) {
+  rollback_device_db(*((db_savepoint_t *) savepoint));
+  return true;
+}
+
 
 void copy_attribute_context(attribute_context_t * from, attribute_context_t * to) {
   to->dbtype = from->dbtype;
@@ -231,6 +249,23 @@ int device_db_last_device_record(int starting) {
   return (num_records - 1);
 }
 
+int find_device_in_device_db(tBDAddr addr) {
+  int i;
+  for (i = 0; i < num_records; i++) {
+    if ((device_db[i].context.dbtype == db_device) && addrs_match(device_db[i].dora.addr, addr)) return i;
+  }
+  return -1;
+}
+
+bool is_last_device_in_device_db(int device_index) {
+  if ((device_index < 0) || (device_index >= num_records) || (device_db[device_index].context.dbtype != db_device)) return false;
+  return device_db_last_device_record(device_index) == num_records - 1;
+}
+
+int num_records_for_device_in_device_db(int device_index) {
+  return device_db_last_device_record(device_index) - device_index + 1;
+}
+
 bool device_db_next_primary_service(int *index, int starting, int ending) {
   int i;
   for (i = starting+1; i < ending; i++) {
@@ -344,10 +379,33 @@ bool device_db_next_characteristic (int *index, int starting, int ending, int pa
       }
       indention -= INDENTION_INCREASE;
     }
+    // values read from the device
+    for (int i = device_index + 1; i <= device_last_index; i++) {
+      if (device_db[i].context.dbtype != db_value) continue;
+      indent(indention);
+      PRINTF("value: handle: %04X value: ", device_db[i].dora.handle_value_pair.handle)
+      for (int j = 0; j < device_db[i].dora.handle_value_pair.len; j++) PRINTF("%02X ", device_db[i].dora.handle_value_pair.value[j])
+      PRINTF("\n");
+    }
     indention -= INDENTION_INCREASE;
   }
 }
 
+// a characteristic's value is the declaration: properties(1) value handle(2) uuid(2 or 16, cut off at MAX_VALUE_LEN)
+uint16_t characteristic_uuid16_in_device_db(int device_index, uint16_t value_handle) {
+  int i;
+  handle_value_pair_t * declaration;
+  for (i = device_index + 1; (i < num_records) && (device_db[i].context.dbtype != db_device); i++) {
+    if (device_db[i].context.dbtype != db_characteristic) continue;
+    declaration = &(device_db[i].dora.handle_value_pair);
+    if (declaration->len != 5) continue;
+    if ((declaration->value[1] + (declaration->value[2] << 8)) == value_handle) return declaration->value[3] + (declaration->value[4] << 8);
+  }
+  return 0;
+}
+
+int num_records_in_device_db() { return num_records; }
+
 void dump_device_db() {
   int i;
   for (i=0; i < num_records; i++) {
@@ -360,9 +418,10 @@ bool add_device_db_entry_from_event(hci_event_pckt *event_pckt, arg_t context_ar
   evt_blue_aci *evt_blue;
   evt_att_read_by_group_resp * read_by_group_type_response;
   evt_att_read_by_type_resp * read_by_type_resp;
+  evt_gatt_disc_read_char_by_uuid_resp * read_by_uuid_resp;
   db_record_t * new_db_record;
   attribute_context_t * context = (attribute_context_t *) context_arg;
-  int i;
+  int i, list_len;
   if (event_pckt->evt == EVT_VENDOR) {
     evt_blue = (evt_blue_aci *) (event_pckt->data);
     switch(evt_blue->ecode) {
@@ -370,9 +429,17 @@ bool add_device_db_entry_from_event(hci_event_pckt *event_pckt, arg_t context_ar
         read_by_group_type_response = (evt_att_read_by_group_resp *) (evt_blue->data); 
         DBPR(DBL_DECODED_EVENTS, read_by_group_type_response->conn_handle, "%d", "read_by_group_type_response for handle")
         print_attr_list(read_by_group_type_response->attribute_data_list, read_by_group_type_response->event_data_length, read_by_group_type_response->attribute_data_length);
-        // for each attribute in the attribute list returned, add it to device_db as a primary service
-        for (i = 0; i < read_by_group_type_response->event_data_length; i += read_by_group_type_response->attribute_data_length) {
+        if ((read_by_group_type_response->attribute_data_length != 6) && (read_by_group_type_response->attribute_data_length != 20)) {
+          PRINTF("read_by_group_type_response with wrong attribute_data_length: %d\n", read_by_group_type_response->attribute_data_length)
+          return false;
+        }
+        // don't go past the end of the event, whatever event_data_length says
+        list_len = event_pckt->plen - (read_by_group_type_response->attribute_data_list - event_pckt->data);
+        if (read_by_group_type_response->event_data_length < list_len) list_len = read_by_group_type_response->event_data_length;
+        // for each (whole) attribute in the attribute list returned, add it to device_db as a primary service
+        for (i = 0; i + read_by_group_type_response->attribute_data_length <= list_len; i += read_by_group_type_response->attribute_data_length) {
           new_db_record = new_entry_in_device_db();
+          if (!new_db_record) return false;
           get_attribute_info(read_by_group_type_response->attribute_data_list + i, read_by_group_type_response->attribute_data_length, &(new_db_record->dora.attr));
           // skip adding this if handle range is invalid (TODO: understand why this happens)
           if (new_db_record->dora.attr.starting_handle > new_db_record->dora.attr.ending_handle) put_back_entry_in_device_db();
@@ -386,13 +453,32 @@ bool add_device_db_entry_from_event(hci_event_pckt *event_pckt, arg_t context_ar
         read_by_type_resp = (evt_att_read_by_type_resp *) (evt_blue->data);
         DBPR(DBL_DECODED_EVENTS, read_by_type_resp->conn_handle, "%d", "evt_att_read_by_type_resp for handle")
         print_attr_list(read_by_type_resp->handle_value_pair, read_by_type_resp->event_data_length, read_by_type_resp->handle_value_pair_length);
-        for (i = 0; i < read_by_type_resp->event_data_length; i += read_by_type_resp->handle_value_pair_length) {
+        if (read_by_type_resp->handle_value_pair_length < 2) {
+          PRINTF("read_by_type_resp with wrong handle_value_pair_length: %d\n", read_by_type_resp->handle_value_pair_length)
+          return false;
+        }
+        list_len = event_pckt->plen - (read_by_type_resp->handle_value_pair - event_pckt->data);
+        if (read_by_type_resp->event_data_length < list_len) list_len = read_by_type_resp->event_data_length;
+        for (i = 0; i + read_by_type_resp->handle_value_pair_length <= list_len; i += read_by_type_resp->handle_value_pair_length) {
           new_db_record = new_entry_in_device_db();
+          if (!new_db_record) return false;
           get_handle_value_pair(read_by_type_resp->handle_value_pair + i, read_by_type_resp->handle_value_pair_length, &(new_db_record->dora.handle_value_pair));
           new_db_record->dora.handle_value_pair.connection_handle = context->connection_handle;
           copy_attribute_context(context, &(new_db_record->context));
         }
         return true;
+      case EVT_BLUE_GATT_DISC_READ_CHAR_BY_UUID_RESP:
+        // one handle and value per event; event_data_length includes the attribute handle
+        read_by_uuid_resp = (evt_gatt_disc_read_char_by_uuid_resp *) (evt_blue->data);
+        if (read_by_uuid_resp->event_data_length < 2) return false;
+        new_db_record = new_entry_in_device_db();
+        if (!new_db_record) return false;
+        new_db_record->dora.handle_value_pair.handle = read_by_uuid_resp->attr_handle;
+        new_db_record->dora.handle_value_pair.len = (read_by_uuid_resp->event_data_length - 2 < MAX_VALUE_LEN) ? read_by_uuid_resp->event_data_length - 2 : MAX_VALUE_LEN;
+        for (i = 0; i < new_db_record->dora.handle_value_pair.len; i++) new_db_record->dora.handle_value_pair.value[i] = read_by_uuid_resp->attr_value[i];
+        new_db_record->dora.handle_value_pair.connection_handle = context->connection_handle;
+        copy_attribute_context(context, &(new_db_record->context));
+        return true;
       default:
         PRINTF("print service discovered called on wrong event type\n");
         return false;      
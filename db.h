@@ -20,6 +20,12 @@
  * - PRIMARY_SERVICES_TODO - check to see if there are unprocessed primary services for a given device
  * - RESET_ALL_PRIMARY_SERVICES - mark all primary services unprocessed so you can enumerate them again for a different purpose
  * - print_db - print out all information in the device db, hierarchically by device, service, then attribute
+ * - savepoint_device_db/rollback_device_db - mark the db before adding a device's subtree and drop everything added since then if that fails
+ * 
+ * Since records are only ever added at the end of the db, a savepoint is just the number of records at that time and rolling back to it
+ * takes constant time and frees the space right away. Savepoints can be nested as long as they are rolled back in reverse order.
+ * A protocol would typically take a savepoint and then use ON_ABORT(rollback_device_db_action, WITH(&savepoint)) so that a failed walk
+ * doesn't leave a half populated device in the db.
  * 
  * Note included services are considered. Whether these get added to the db or not is up to the calling application, but if they are added, then
  * they are printed and available, along with their characteristics. This has not been fully tested as I've not seen anything with included services to test it with.
@@ -51,7 +57,8 @@
  * The notion to capture this is a "dora" which is either a device or some type of attribute in the device's GATT.
  */
 
-typedef enum {db_device, db_primary_service, db_included_service, db_characteristic} db_type;
+// db_value is a (handle, value) pair read from the device, e.g., by a sweep read (see procedures.h), with the device as parent
+typedef enum {db_device, db_primary_service, db_included_service, db_characteristic, db_value} db_type;
 
 typedef union dora_u {
   tBDAddr addr;
@@ -78,12 +85,20 @@ typedef struct db_record_s {
 int add_device_to_device_db(tBDAddr * device_addr);
 
 int last_entry_for_device_in_device_db(int device_index);
+int find_device_in_device_db(tBDAddr addr);                 // index of the device's record, or -1 if it isn't in the db
+int num_records_for_device_in_device_db(int device_index);  // the device's record and everything found under it
+bool is_last_device_in_device_db(int device_index);         // records added now would end up under this device
 
 // The following can be used as an action to perform to populate the db with info from the attribute info in an event response
 bool add_device_db_entry_from_event(hci_event_pckt *event_pckt, arg_t context_arg);
 
 db_record_t * new_entry_in_device_db(); // just returns a pointer to a new DB entry that the client can fill out
 void put_back_entry_in_device_db();     // when decide not to use this entry (kind of like pop)
+
+typedef int db_savepoint_t;
+db_savepoint_t savepoint_device_db();
+void rollback_device_db(db_savepoint_t savepoint);
+bool rollback_device_db_action(arg_t savepoint); // pointer to a db_savepoint_t; usable as an ON_ABORT action
 void copy_attribute_context(attribute_context_t * from, attribute_context_t * to);
 
 attribute_info_t * get_attribute_info_from_device_db(int index);
@@ -91,8 +106,12 @@ handle_value_pair_t * get_handle_value_pair_from_device_db(int index);
 
 int add_attribute_to_device_db(attribute_info_t * attribute, attribute_context_t context);
 
+// the 16 bit uuid of the characteristic with the given value handle found for the device, or 0 if there isn't one (or its uuid is 128 bit)
+uint16_t characteristic_uuid16_in_device_db(int device_index, uint16_t value_handle);
+
 void print_device_db();
 void dump_device_db();
+int num_records_in_device_db();
 
 void mark_processed_in_device_db(int index);
 
@@ -26,6 +26,7 @@ static unsigned long printfor = 0;
 static unsigned long print_start_time;
 static bool printed_end = false;
 static unsigned long last_print_time = 0;
+static bool muted = false;
 
 void DB_set_lvl(int lvl) { db_lvl = lvl; }
 int  DB_get_lvl() { return db_lvl; }
@@ -50,6 +51,9 @@ void DB_print_for(unsigned long t) {
   printed_end = false;
 }
 
+void DB_mute(bool mute) { muted = mute; }
+bool DB_muted() { return muted; }
+
 bool DB_time_expired() {
   if (printed_end) return true;
   if ((printfor == 0)) return true;
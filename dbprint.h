@@ -69,6 +69,8 @@
 void DB_set_lvl(int lvl) {}
 int  DB_get_lvl() {return 0;}
 void DB_print_for(unsigned long t) {} 
+void DB_mute(bool mute) {}
+bool DB_muted() {return true;}
 unsigned long DB_delta {}
 #define DB_BREADCRUMB {}
 #define DBPR(DBNUM, DBVAR, DBFMT, DBMSG)  {}
@@ -89,6 +91,10 @@ bool DB_time_expired();
 
 void DB_print_for(unsigned long t);
 
+// Muting stops all output, PRINTF included, e.g., while the serial port carries binary frames (see relay.h).
+void DB_mute(bool mute);
+bool DB_muted();
+
 #define DBLIMIT_BEGIN(DBNUM) \
 if ( !DB_time_expired() ) {  \
    if (DB_get_lvl() >= DBNUM) { 
@@ -105,8 +111,8 @@ if ( !DB_time_expired() ) {  \
 
 char* DB_buffer();
 
-// A general print statement, not limited.
-#define PRINTF(...) {sprintf(DB_buffer() ,__VA_ARGS__); SerialUSB.print(DB_buffer());}
+// A general print statement, not limited (except by DB_mute).
+#define PRINTF(...) {if (!DB_muted()) {sprintf(DB_buffer() ,__VA_ARGS__); SerialUSB.print(DB_buffer());}}
 
 // The following is a macro trick to enable strings passed in to be printed as part of the output
 #define STRINGIFY2(X) #X
@@ -0,0 +1,281 @@
+/*!
+ * @file fuzz.cpp
+ * @brief Implementation of the cost guided fuzzer
+ * @details
+ * Inputs are whole hci_uart_pckt's (type, evt, plen, data) where plen is always kept consistent with the number of bytes, since the
+ * transport frames events by plen; the fields inside the event are what get corrupted. The random numbers come from a small xorshift
+ * generator so a run can be repeated with the same seed.
+ * 
+ *  fine-print: copyright 2021 David Hamilton. This software may be freely copied and used under MIT license (see LICENSE.txt in root directory).
+ */
+
+/*
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "fuzz.h"
+#include "production.h"
+#include "protocol.h"
+#include "get_data.h"
+#include "db.h"
+#include "dbprint.h"
+
+#define FUZZ_HEADER_SIZE 3   // type, evt, plen
+
+static fuzz_case_t corpus[FUZZ_CORPUS_SIZE];
+static int corpus_size = 0;
+static fuzz_case_t candidate;
+static unsigned long budget = 0;
+static unsigned long inputs_run = 0;
+static unsigned long over_budget = 0;
+static uint32_t random_state = 1;
+static attribute_context_t fuzz_context;
+static const uint8_t interesting_values[] = {0, 1, 2, 6, 7, 20, 21, 0x7F, 0x80, 0xFE, 0xFF};
+static const char * target_names[num_fuzz_targets] = {"db_entry", "advertising_info", "production"};
+
+static uint32_t next_random() {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+  return random_state;
+}
+
+static uint32_t random_below(uint32_t n) { return n ? next_random() % n : 0; }
+
+void fuzz_set_budget(unsigned long microseconds) { budget = microseconds; }
+
+/////////////////////////////////////////////////////////////
+// running inputs
+
+static bool fuzz_rule_action(hci_event_pckt *event_pckt, arg_t context) {
+  return add_device_db_entry_from_event(event_pckt, context);
+}
+
+// rules that match the event (so they all fire), alternating kinds
+static void set_fuzz_rules(fuzz_case_t * c) {
+  hci_event_pckt * event_pckt = (hci_event_pckt *) (c->pckt + 1);
+  uint16_t code = event_pckt->data[0] + (event_pckt->data[1] << 8);
+  int i;
+  clear_expectations();
+  clear_exclusive_expectations();
+  for (i = 0; i < c->num_rules; i++) {
+    switch (i % 3) {
+      case 0: expect(event_check, event_pckt->evt, AND_DO(fuzz_rule_action), WITH(&fuzz_context)); break;
+      case 1: expect(ecode, code, AND_DO(fuzz_rule_action), WITH(&fuzz_context)); break;
+      case 2: expect_ex(ecode, code, AND_DO(fuzz_rule_action), WITH(&fuzz_context)); break;
+    }
+  }
+  until_event(event_check, 0);   // never met, so the rules stay for the next repeat
+}
+
+static void clear_fuzz_rules() {
+  clear_expectations();
+  clear_exclusive_expectations();
+  until_clear();
+  until_event_clear();
+}
+
+static unsigned long run_case(fuzz_case_t * c) {
+  unsigned long start, cost = 0;
+  db_savepoint_t savepoint = savepoint_device_db();
+  hci_event_pckt * event_pckt = (hci_event_pckt *) (c->pckt + 1);
+  bool was_muted = DB_muted();
+  int r;
+  // printing an error message takes far longer than the parsing that finds the error, so without muting the search would favor rejects
+  DB_mute(true);
+  if (c->target == fuzz_production) set_fuzz_rules(c);
+  for (r = 0; r < FUZZ_REPEATS; r++) {
+    start = micros();
+    switch (c->target) {
+      case fuzz_db_entry:         add_device_db_entry_from_event(event_pckt, &fuzz_context); break;
+      case fuzz_advertising_info: get_advertising_info(event_pckt); break;
+      case fuzz_production:       run_production(c->pckt); break;
+    }
+    cost += micros() - start;
+    rollback_device_db(savepoint);
+  }
+  if (c->target == fuzz_production) clear_fuzz_rules();
+  DB_mute(was_muted);
+  inputs_run++;
+  return cost;
+}
+
+unsigned long fuzz_replay(uint8_t target, uint8_t num_rules, const uint8_t * pckt, uint8_t len) {
+  if (len > HCI_READ_PACKET_SIZE) len = HCI_READ_PACKET_SIZE;
+  memset(&candidate, 0, sizeof(candidate));
+  candidate.target = target;
+  candidate.num_rules = num_rules;
+  candidate.len = len;
+  memcpy(candidate.pckt, pckt, len);
+  return run_case(&candidate);
+}
+
+/////////////////////////////////////////////////////////////
+// inputs to start from
+
+static void put_header(fuzz_case_t * c, uint8_t target, uint8_t evt, uint8_t len) {
+  memset(c, 0, sizeof(fuzz_case_t));
+  c->target = target;
+  c->num_rules = 3;
+  c->len = len;
+  c->pckt[0] = HCI_EVENT_PKT;
+  c->pckt[1] = evt;
+  c->pckt[2] = len - FUZZ_HEADER_SIZE;
+}
+
+// three 16 bit uuid services
+static void seed_read_by_group_type_resp(fuzz_case_t * c, uint8_t target) {
+  const uint8_t data[] = {EVT_BLUE_ATT_READ_BY_GROUP_TYPE_RESP & 0xFF, EVT_BLUE_ATT_READ_BY_GROUP_TYPE_RESP >> 8, 0x01, 0x08, 19, 6,
+                          0x01, 0x00, 0x07, 0x00, 0x00, 0x18,  0x08, 0x00, 0x0B, 0x00, 0x01, 0x18,  0x0C, 0x00, 0xFF, 0xFF, 0x0F, 0x18};
+  put_header(c, target, EVT_VENDOR, FUZZ_HEADER_SIZE + sizeof(data));
+  memcpy(c->pckt + FUZZ_HEADER_SIZE, data, sizeof(data));
+}
+
+// two 16 bit uuid characteristic declarations
+static void seed_read_by_type_resp(fuzz_case_t * c, uint8_t target) {
+  const uint8_t data[] = {EVT_BLUE_ATT_READ_BY_TYPE_RESP & 0xFF, EVT_BLUE_ATT_READ_BY_TYPE_RESP >> 8, 0x01, 0x08, 15, 7,
+                          0x02, 0x00, 0x02, 0x03, 0x00, 0x00, 0x2A,  0x04, 0x00, 0x02, 0x05, 0x00, 0x01, 0x2A};
+  put_header(c, target, EVT_VENDOR, FUZZ_HEADER_SIZE + sizeof(data));
+  memcpy(c->pckt + FUZZ_HEADER_SIZE, data, sizeof(data));
+}
+
+// one report with flags and a short name
+static void seed_advertising_report(fuzz_case_t * c, uint8_t target) {
+  const uint8_t data[] = {EVT_LE_ADVERTISING_REPORT, 1, 0x00, 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 8,
+                          0x02, 0x01, 0x06, 0x04, 0x09, 'a', 'b', 'c', 0xC4};
+  put_header(c, target, EVT_LE_META_EVENT, FUZZ_HEADER_SIZE + sizeof(data));
+  memcpy(c->pckt + FUZZ_HEADER_SIZE, data, sizeof(data));
+}
+
+// replaces the cheapest case for the same target, so every target keeps being searched
+static void add_to_corpus(fuzz_case_t * c) {
+  int i, cheapest = -1;
+  if (corpus_size < FUZZ_CORPUS_SIZE) {
+    corpus[corpus_size++] = *c;
+    return;
+  }
+  for (i = 0; i < corpus_size; i++) {
+    if ((corpus[i].target == c->target) && ((cheapest < 0) || (corpus[i].cost < corpus[cheapest].cost))) cheapest = i;
+  }
+  if ((cheapest >= 0) && (c->cost > corpus[cheapest].cost)) corpus[cheapest] = *c;
+}
+
+static void seed_corpus() {
+  corpus_size = 0;
+  seed_read_by_group_type_resp(&candidate, fuzz_db_entry);
+  candidate.cost = run_case(&candidate);
+  add_to_corpus(&candidate);
+  seed_read_by_type_resp(&candidate, fuzz_db_entry);
+  candidate.cost = run_case(&candidate);
+  add_to_corpus(&candidate);
+  seed_advertising_report(&candidate, fuzz_advertising_info);
+  candidate.cost = run_case(&candidate);
+  add_to_corpus(&candidate);
+  seed_read_by_type_resp(&candidate, fuzz_production);
+  candidate.cost = run_case(&candidate);
+  add_to_corpus(&candidate);
+}
+
+/////////////////////////////////////////////////////////////
+// mutating
+
+static void mutate(fuzz_case_t * c) {
+  int n, pos, new_len;
+  for (n = 1 + random_below(3); n > 0; n--) {
+    pos = FUZZ_HEADER_SIZE + random_below(c->len - FUZZ_HEADER_SIZE);
+    switch (random_below(5)) {
+      case 0:   // flip a bit
+        c->pckt[pos] ^= 1 << random_below(8);
+        break;
+      case 1:   // boundary value, most likely to hit a length field
+        c->pckt[pos] = interesting_values[random_below(sizeof(interesting_values))];
+        break;
+      case 2:   // random byte
+        c->pckt[pos] = random_below(256);
+        break;
+      case 3:   // shorter or longer event
+        new_len = FUZZ_HEADER_SIZE + 2 + random_below(HCI_READ_PACKET_SIZE - FUZZ_HEADER_SIZE - 2);
+        while (c->len < new_len) c->pckt[c->len++] = random_below(256);
+        c->len = new_len;
+        break;
+      case 4:   // number of rules
+        c->num_rules = random_below(MAX_RULES + 1);
+        break;
+    }
+    c->pckt[2] = c->len - FUZZ_HEADER_SIZE;
+  }
+}
+
+static void check_budget(fuzz_case_t * c) {
+  if (!budget || (c->cost <= budget)) return;
+  over_budget++;
+  PRINTF("FUZZ over budget: %s, %d rules, %lu us\n", target_names[c->target], c->num_rules, c->cost)
+}
+
+bool fuzz_run(unsigned long iterations, uint32_t seed) {
+  rule_usage_t usage;
+  unsigned long i;
+  rule_usage(&usage);
+  if (usage.global_rules || protocol_running()) {
+    PRINTF("fuzz_run: can't run with global expectations or a protocol running\n")
+    return false;
+  }
+  random_state = seed ? seed : 1;
+  inputs_run = 0;
+  over_budget = 0;
+  set_context(&fuzz_context, db_characteristic, 0, 0x0801);
+  seed_corpus();
+  for (i = 0; i < iterations; i++) {
+    candidate = corpus[random_below(corpus_size)];
+    mutate(&candidate);
+    candidate.cost = run_case(&candidate);
+    check_budget(&candidate);
+    add_to_corpus(&candidate);
+  }
+  return true;
+}
+
+/////////////////////////////////////////////////////////////
+// minimizing and printing
+
+// drop bytes from the end and zero bytes while the case stays at least 90% as expensive
+static void minimize(fuzz_case_t * c) {
+  int pos;
+  uint8_t saved;
+  unsigned long cost, keep_above = c->cost - c->cost / 10;
+  candidate = *c;
+  while (candidate.len > FUZZ_HEADER_SIZE + 2) {
+    candidate.len--;
+    candidate.pckt[2] = candidate.len - FUZZ_HEADER_SIZE;
+    if (run_case(&candidate) < keep_above) {
+      candidate.len++;
+      candidate.pckt[2] = candidate.len - FUZZ_HEADER_SIZE;
+      break;
+    }
+  }
+  for (pos = FUZZ_HEADER_SIZE; pos < candidate.len; pos++) {
+    if (candidate.pckt[pos] == 0) continue;
+    saved = candidate.pckt[pos];
+    candidate.pckt[pos] = 0;
+    cost = run_case(&candidate);
+    if (cost < keep_above) candidate.pckt[pos] = saved;
+  }
+  candidate.cost = run_case(&candidate);
+  *c = candidate;
+}
+
+void print_fuzz_results() {
+  int i, b;
+  PRINTF("fuzz: %lu inputs run, %lu over budget of %lu us\n", inputs_run, over_budget, budget)
+  for (i = 0; i < corpus_size; i++) {
+    minimize(&(corpus[i]));
+    PRINTF("FUZZ CASE %d: target %s (%d), %d rules, %lu us, %d bytes:\n", i, target_names[corpus[i].target], corpus[i].target, corpus[i].num_rules, corpus[i].cost, corpus[i].len)
+    for (b = 0; b < corpus[i].len; b++) {
+      PRINTF("0x%02X,%s", corpus[i].pckt[b], ((b % 16) == 15) ? "\n" : " ")
+    }
+    PRINTF("\n")
+  }
+}
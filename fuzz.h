@@ -0,0 +1,62 @@
+/*!
+ * @file fuzz.h
+ * @brief A cost guided fuzzer that searches for the HCI events (and rule sets) that take the longest to process.
+ * @details
+ * Some packet shapes cost far more than others (long attribute lists, bad length fields, many matching rules) and are otherwise only
+ * found in the field. The fuzzer starts from a few typical events, mutates them (bit flips, boundary values in length fields, truncation,
+ * the number of rules set up), and times each one through one of the targets:
+ * - fuzz_db_entry: add_device_db_entry_from_event
+ * - fuzz_advertising_info: get_advertising_info
+ * - fuzz_production: run_production with the mutated number of rules (expect and expect_ex, matching the event) adding to the device db
+ * 
+ * The FUZZ_CORPUS_SIZE most expensive inputs found (two for db_entry and one each for the others) are kept and mutated further, so the
+ * search climbs towards the worst cases. Any input over the budget is printed right away. At the end, each worst case is minimized 
+ * (shortened and zeroed as long as it stays as expensive) and printed as hex, which can be pasted into code and timed again with 
+ * fuzz_replay as a regression benchmark.
+ * 
+ * Typical usage, from setup() before anything else is set up (the fuzzer refuses to run with global expectations or a protocol running, 
+ * since those would react to the fake events):
+ *     fuzz_set_budget(500);
+ *     fuzz_run(10000, 1);
+ *     print_fuzz_results();
+ * 
+ * Everything the fuzzer adds to the device db is rolled back. Debug output is muted while an input runs (see DB_mute), so the cost is the
+ * code under test and not the printing of its error messages.
+ * 
+ *  fine-print: copyright 2021 David Hamilton. This software may be freely copied and used under MIT license (see LICENSE.txt in root directory).
+ */
+
+/*
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FUZZ_H
+#define FUZZ_H
+
+#include <stdint.h>
+#include <STBLE.h>
+
+// number of worst cases kept
+#define FUZZ_CORPUS_SIZE 4
+
+// each input is run this many times and the total is its cost, to get above the resolution of micros()
+#define FUZZ_REPEATS 4
+
+typedef enum {fuzz_db_entry, fuzz_advertising_info, fuzz_production, num_fuzz_targets} fuzz_target_t;
+
+typedef struct fuzz_case_s {
+  uint8_t target;
+  uint8_t num_rules;   // for fuzz_production
+  uint8_t len;         // bytes of pckt, a whole hci_uart_pckt
+  uint8_t pckt[HCI_READ_PACKET_SIZE];
+  unsigned long cost;  // us for FUZZ_REPEATS runs
+} fuzz_case_t;
+
+void fuzz_set_budget(unsigned long microseconds);   // 0 for no budget
+bool fuzz_run(unsigned long iterations, uint32_t seed);
+unsigned long fuzz_replay(uint8_t target, uint8_t num_rules, const uint8_t * pckt, uint8_t len);
+void print_fuzz_results();
+
+#endif
@@ -56,7 +56,10 @@ void copy_attribute_info(attribute_info_t * from, attribute_info_t * to) {
 void get_handle_value_pair(uint8_t * handle_value_pair_list, int handle_value_pair_len, handle_value_pair_t * handle_value_pair) {
   handle_value_pair->handle = handle_value_pair_list[1];
   handle_value_pair->handle = (handle_value_pair->handle << 8) + handle_value_pair_list[0];
-  handle_value_pair->len = handle_value_pair_len - 2;
+  // the value is cut off at MAX_VALUE_LEN
+  if (handle_value_pair_len < 2) handle_value_pair->len = 0;
+  else if (handle_value_pair_len - 2 > MAX_VALUE_LEN) handle_value_pair->len = MAX_VALUE_LEN;
+  else handle_value_pair->len = handle_value_pair_len - 2;
   for (int i = 0; i < handle_value_pair->len; i++) handle_value_pair->value[i] = handle_value_pair_list[i+2];
 }
 
@@ -70,14 +73,17 @@ void copy_handle_vlaue_pair(handle_value_pair_t * from, handle_value_pair_t * to
 ble_advertising_info_t advertising_info;
 
 ble_advertising_info_t * get_advertising_info(hci_event_pckt *event_pckt) {
-  int index;
+  int index, available;
   evt_le_meta_event *report_event_pckt;
   report_event_pckt = (evt_le_meta_event *) event_pckt->data;
   le_advertising_info *report_pckt = (le_advertising_info *) (report_event_pckt->data+1); 
   advertising_info.evt_type = report_pckt->evt_type;
   advertising_info.bdaddr_type = report_pckt->bdaddr_type;
   copy_addr(report_pckt->bdaddr, &(advertising_info.bdaddr));
-  advertising_info.data_length = report_pckt->data_length;
+  // don't trust data_length beyond what the event holds (less the RSSI at the end)
+  available = event_pckt->plen - (report_pckt->data_RSSI - event_pckt->data) - 1;
+  if (available < 0) available = 0;
+  advertising_info.data_length = (report_pckt->data_length < available) ? report_pckt->data_length : available;
   for (index = 0; index < advertising_info.data_length; index++) advertising_info.data[index] = report_pckt->data_RSSI[index];
   advertising_info.rssi_value = report_pckt->data_RSSI[advertising_info.data_length];
   return &advertising_info;
@@ -120,10 +126,11 @@ bool get_disconnection_complete(hci_event_pckt *event_pckt, void * of_type_ptr_t
 }
 
 void print_attr_list(uint8_t * attr_list, uint8_t total_len, uint8_t attr_len) {
-  uint8_t i;
+  int i;
   uint8_t * attr_start;
   DBMSG(DBL_DECODED_EVENTS, "attribute list:")
-  for (i=0; i < total_len; i += attr_len) {
+  if (attr_len == 0) return;
+  for (i=0; i + attr_len <= total_len; i += attr_len) {
     attr_start = attr_list + i;
     DBPRN(DBL_DECODED_EVENTS, attr_start, attr_len, "attribute")
   }
@@ -0,0 +1,169 @@
+/*!
+ * @file lanes.cpp
+ * @brief Implementation of priority lanes for incoming events
+ * @details
+ * Each lane is a ring of packet copies. lanes_drain picks the next lane to process with next_lane and runs the current protocol on the
+ * oldest event of that lane, until all lanes are empty.
+ * 
+ *  fine-print: copyright 2021 David Hamilton. This software may be freely copied and used under MIT license (see LICENSE.txt in root directory).
+ */
+
+/*
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "lanes.h"
+#include "protocol.h"
+#include "dbprint.h"
+
+typedef struct lane_slot_s {
+  unsigned long added;   // micros()
+  uint8_t pckt[HCI_READ_PACKET_SIZE];
+} lane_slot_t;
+
+static lane_slot_t control_slots[LANE_CONTROL_SIZE];
+static lane_slot_t att_slots[LANE_ATT_SIZE];
+static lane_slot_t advertising_slots[LANE_ADVERTISING_SIZE];
+
+typedef struct lane_s {
+  lane_slot_t * slots;
+  int size;
+  int first;
+  int waiting;
+  int share;
+  int passed_over;
+  bool drop_oldest;
+  lane_stats_t stats;
+} lane_info_t;
+
+static lane_info_t lanes[num_lanes] = {
+  {control_slots, LANE_CONTROL_SIZE, 0, 0, 0, 0, false, {}},
+  {att_slots, LANE_ATT_SIZE, 0, 0, 0, 0, false, {}},
+  {advertising_slots, LANE_ADVERTISING_SIZE, 0, 0, LANES_ADVERTISING_SHARE, 0, true, {}}
+};
+
+static const char * lane_names[num_lanes] = {"control", "att", "advertising"};
+
+lane_t lane_for_event(void * pckt) {
+  hci_event_pckt * event_pckt;
+  evt_le_meta_event * meta_pckt;
+  uint16_t ecode;
+  if (((hci_uart_pckt *) pckt)->type != HCI_EVENT_PKT) return lane_control;
+  event_pckt = (hci_event_pckt *) ((hci_uart_pckt *) pckt)->data;
+  switch (event_pckt->evt) {
+    case EVT_LE_META_EVENT:
+      meta_pckt = (evt_le_meta_event *) event_pckt->data;
+      if (meta_pckt->subevent == EVT_LE_ADVERTISING_REPORT) return lane_advertising;
+      return lane_control;
+    case EVT_VENDOR:
+      ecode = ((evt_blue_aci *) event_pckt->data)->ecode;
+      if ((ecode == EVT_BLUE_GAP_DEVICE_FOUND) || (ecode == EVT_BLUE_GAP_PROCEDURE_COMPLETE)) return lane_advertising;
+      if ((ecode >= EVT_BLUE_GATT_ATTRIBUTE_MODIFIED) && (ecode <= EVT_BLUE_GATT_PREPARE_WRITE_PERMIT_REQ)) return lane_att;
+      return lane_control;
+    default:
+      return lane_control;
+  }
+}
+
+static void process_oldest(lane_info_t * lane) {
+  lane_slot_t * slot = &(lane->slots[lane->first]);
+  unsigned long delay = micros() - slot->added;
+  lane->first = (lane->first + 1) % lane->size;
+  lane->waiting--;
+  lane->stats.events++;
+  lane->stats.total_delay += delay;
+  if (delay > lane->stats.max_delay) lane->stats.max_delay = delay;
+  // the slot isn't reused until the next lanes_add, which can't happen while the protocol is running
+  run_current_protocol(slot->pckt);
+}
+
+static bool is_advertising_report(lane_slot_t * slot) {
+  hci_event_pckt * event_pckt = (hci_event_pckt *) ((hci_uart_pckt *) slot->pckt)->data;
+  if (((hci_uart_pckt *) slot->pckt)->type != HCI_EVENT_PKT) return false;
+  if (event_pckt->evt != EVT_LE_META_EVENT) return false;
+  return ((evt_le_meta_event *) event_pckt->data)->subevent == EVT_LE_ADVERTISING_REPORT;
+}
+
+// drops the oldest advertising report, keeping the order of the rest; false if there are only other events (e.g., the end of a discovery)
+static bool drop_oldest_report(lane_info_t * lane) {
+  int i, j;
+  for (i = 0; i < lane->waiting; i++) {
+    if (!is_advertising_report(&(lane->slots[(lane->first + i) % lane->size]))) continue;
+    for (j = i; j > 0; j--) lane->slots[(lane->first + j) % lane->size] = lane->slots[(lane->first + j - 1) % lane->size];
+    lane->first = (lane->first + 1) % lane->size;
+    lane->waiting--;
+    return true;
+  }
+  return false;
+}
+
+void lanes_add(void * pckt) {
+  lane_info_t * lane = &(lanes[lane_for_event(pckt)]);
+  lane_slot_t * slot;
+  int len;
+  if (lane->waiting == lane->size) {
+    if (lane->drop_oldest && drop_oldest_report(lane)) {
+      lane->stats.dropped++;
+    }
+    else {
+      lane->stats.forced++;
+      process_oldest(lane);
+    }
+  }
+  slot = &(lane->slots[(lane->first + lane->waiting) % lane->size]);
+  if (((hci_uart_pckt *) pckt)->type == HCI_EVENT_PKT) len = 1 + 2 + ((hci_event_pckt *) ((hci_uart_pckt *) pckt)->data)->plen;
+  else len = HCI_READ_PACKET_SIZE;
+  if (len > HCI_READ_PACKET_SIZE) len = HCI_READ_PACKET_SIZE;
+  memcpy(slot->pckt, pckt, len);
+  slot->added = micros();
+  lane->waiting++;
+  if (lane->waiting > lane->stats.max_waiting) lane->stats.max_waiting = lane->waiting;
+}
+
+// highest lane with events waiting, unless a lower one has been passed over its share of times
+static lane_info_t * next_lane() {
+  int l;
+  lane_info_t * chosen = NULL;
+  for (l = num_lanes - 1; l > 0; l--) {
+    if (lanes[l].waiting && lanes[l].share && (lanes[l].passed_over >= lanes[l].share)) {
+      chosen = &(lanes[l]);
+      break;
+    }
+  }
+  for (l = 0; !chosen && (l < num_lanes); l++) {
+    if (lanes[l].waiting) chosen = &(lanes[l]);
+  }
+  if (!chosen) return NULL;
+  for (l = 0; l < num_lanes; l++) {
+    if (&(lanes[l]) == chosen) lanes[l].passed_over = 0;
+    else if (lanes[l].waiting) lanes[l].passed_over++;
+  }
+  return chosen;
+}
+
+void lanes_drain() {
+  lane_info_t * lane;
+  while ((lane = next_lane()) != NULL) process_oldest(lane);
+}
+
+void lanes_set_share(lane_t lane, int share) {
+  if (lane < num_lanes) lanes[lane].share = share;
+}
+
+void get_lane_stats(lane_t lane, lane_stats_t * stats) {
+  if (lane < num_lanes) *stats = lanes[lane].stats;
+}
+
+void print_lane_stats() {
+  int l;
+  lane_stats_t * s;
+  for (l = 0; l < num_lanes; l++) {
+    s = &(lanes[l].stats);
+    PRINTF("lane %s: %lu events, ", lane_names[l], s->events)
+    PRINTF("avg delay %lu us, max delay %lu us, ", s->events ? s->total_delay / s->events : 0, s->max_delay)
+    PRINTF("max waiting %d, %lu dropped, %lu forced\n", s->max_waiting, s->dropped, s->forced)
+  }
+}
@@ -0,0 +1,74 @@
+/*!
+ * @file lanes.h
+ * @brief Priority lanes for incoming events, so that connection and ATT events don't wait behind a flood of advertising reports.
+ * @details
+ * Normally HCI_Event_CB runs the current protocol on each event in the order received. In a dense scan, a batch of events from the
+ * BlueNRG can be mostly advertising reports, and a connection complete, connection update request, or ATT response behind them
+ * waits until they have all been processed. With lanes, HCI_Event_CB only copies each event into one of three lanes:
+ * - lane_control: connection complete/update, disconnection complete, L2CAP, HAL and command events, and anything else not below
+ * - lane_att: ATT responses and GATT events, including EVT_BLUE_GATT_PROCEDURE_COMPLETE (so it stays after the responses of its procedure)
+ * - lane_advertising: advertising reports and GAP device found/procedure complete (so the end of discovery stays after its reports)
+ * 
+ * and lanes_drain (called from loop right after HCI_Process) runs the current protocol on them, highest lane first. So that advertising
+ * isn't starved when there is a lot of ATT traffic, a lower lane gets one event processed after being passed over its share of times
+ * (see lanes_set_share; by default the advertising lane gets 1 of every LANES_ADVERTISING_SHARE+1 events while it has events waiting).
+ * 
+ * When a lane is full: the oldest advertising report is dropped (and counted), since another will come along; anything else, in any
+ * lane, is never dropped but processed right away to make room, since losing one (e.g., the GAP procedure complete that ends a discovery)
+ * would break the protocol. Dropped reports are never seen by the protocol or by relay_advertising_reports (see relay.h).
+ * 
+ * Typical usage:
+ *     void loop() {
+ *       ...
+ *       HCI_Process();
+ *       lanes_drain();
+ *     }
+ *     void HCI_Event_CB(void *pckt) {
+ *       lanes_add(pckt);
+ *     }
+ * 
+ * Each lane slot holds a copy of the packet (up to HCI_READ_PACKET_SIZE bytes), so the lane sizes are kept small.
+ * 
+ *  fine-print: copyright 2021 David Hamilton. This software may be freely copied and used under MIT license (see LICENSE.txt in root directory).
+ */
+
+/*
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef LANES_H
+#define LANES_H
+
+#include <stdint.h>
+#include <STBLE.h>
+
+// number of events each lane can hold
+#define LANE_CONTROL_SIZE 4
+#define LANE_ATT_SIZE 6
+#define LANE_ADVERTISING_SIZE 6
+
+// default number of times the advertising lane can be passed over (while it has events) before it gets an event processed
+#define LANES_ADVERTISING_SHARE 4
+
+typedef enum {lane_control, lane_att, lane_advertising, num_lanes} lane_t;
+
+typedef struct lane_stats_s {
+  unsigned long events;
+  unsigned long dropped;
+  unsigned long forced;        // events processed early to make room
+  unsigned long total_delay;   // us between being added and being processed
+  unsigned long max_delay;
+  int max_waiting;
+} lane_stats_t;
+
+void lanes_add(void * pckt);
+void lanes_drain();
+void lanes_set_share(lane_t lane, int share);  // 0 for strict priority
+lane_t lane_for_event(void * pckt);
+
+void get_lane_stats(lane_t lane, lane_stats_t * stats);
+void print_lane_stats();
+
+#endif
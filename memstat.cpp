@@ -0,0 +1,87 @@
+/*!
+ * @file memstat.cpp
+ * @brief Implementation of stack and RAM usage telemetry
+ * @details
+ * The RAM layout assumed is the usual one for ARM Arduino cores: static data, then the heap growing up (sbrk), then free space, then the
+ * stack growing down from the top of RAM. If the heap grows into the painted area after painting, that shows up as stack usage.
+ * 
+ *  fine-print: copyright 2021 David Hamilton. This software may be freely copied and used under MIT license (see LICENSE.txt in root directory).
+ */
+
+/*
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include "memstat.h"
+#include "protocol.h"
+#include "addrs.h"
+#include "db.h"
+#include "dbprint.h"
+
+extern "C" char * sbrk(int incr);
+
+#define STACK_PAINT 0xA5A5A5A5
+
+static uint32_t * paint_bottom = NULL;  // first painted word (just above the heap when painted)
+static uint32_t * paint_top = NULL;     // just past the last painted word
+static uint32_t * stack_low_water;      // lowest word found touched so far
+
+// the caller's stack depth, give or take this function's frame; returning the address of a local instead is undefined and gets
+// optimized to NULL
+static __attribute__((noinline)) char * stack_pointer() {
+  return (char *) __builtin_frame_address(0);
+}
+
+void memstat_paint_stack() {
+  uint32_t * p;
+  paint_bottom = (uint32_t *) (((uintptr_t) sbrk(0) + 3) & ~3);
+  paint_top = (uint32_t *) (((uintptr_t) stack_pointer() - STACK_PAINT_MARGIN) & ~3);
+  for (p = paint_bottom; p < paint_top; p++) *p = STACK_PAINT;
+  stack_low_water = paint_top;
+}
+
+// walks up from the bottom of the painted area to the first touched word; the stack only ever gets deeper, so the walk can stop at the
+// previous low water mark, but it does cover all the untouched words below it every time
+static void update_low_water() {
+  uint32_t * p;
+  if (!paint_bottom) return;
+  for (p = paint_bottom; (p < stack_low_water) && (*p == STACK_PAINT); p++);
+  stack_low_water = p;
+}
+
+void get_memory_stats(memory_stats_t * stats) {
+  char * heap_top = sbrk(0);
+  update_low_water();
+  stats->free_ram = stack_pointer() - heap_top;
+  if (paint_bottom) {
+    stats->min_free_ram = (char *) stack_low_water - heap_top;
+    stats->stack_high_water = (char *) paint_top - (char *) stack_low_water;
+  }
+  else {
+    stats->min_free_ram = -1;
+    stats->stack_high_water = -1;
+  }
+  stats->device_db_records = num_records_in_device_db();
+  stats->addrs = num_addrs_in_list();
+  rule_usage(&(stats->rules));
+  stats->longest_action_name = get_longest_action_name();
+  stats->longest_protocol_name = get_longest_protocol_name();
+}
+
+void print_memory_stats() {
+  memory_stats_t stats;
+  get_memory_stats(&stats);
+  PRINTF("\n------------------- MEMORY USAGE ------------------------\n");
+  PRINTF("free RAM: %d, minimum free RAM: %d, stack high water: %d\n", stats.free_ram, stats.min_free_ram, stats.stack_high_water)
+  PRINTF("device db records: %d of %d\n", stats.device_db_records, MAX_RECORDS)
+  PRINTF("addresses: %d of %d\n", stats.addrs, MAX_ADDRS)
+  PRINTF("rules: %d (max %d), exclusive rules: %d (max %d), global rules: %d (max %d) of %d each\n", 
+         stats.rules.rules, stats.rules.max_rules, stats.rules.exclusive_rules, stats.rules.max_exclusive_rules, 
+         stats.rules.global_rules, stats.rules.max_global_rules, MAX_RULES)
+  PRINTF("longest action name: %d of %d, longest protocol name: %d of %d\n", 
+         stats.longest_action_name, MAX_ACTION_STRING_SIZE - 1, stats.longest_protocol_name, MAX_PROTOCOL_STRING_SIZE - 1)
+  PRINTF("==================== END OF MEMORY USAGE ================\n"); 
+}
@@ -0,0 +1,48 @@
+/*!
+ * @file memstat.h
+ * @brief Telemetry on stack and RAM usage, and on how full the fixed size tables are.
+ * @details
+ * Everything in this project uses statically allocated tables, plus there are deep call chains from HCI_Event_CB through run_production,
+ * the rules, and the actions. On a SAMD21 a stack overflow just silently corrupts those tables, so it helps to know how much room is left.
+ * 
+ * memstat_paint_stack() (call it first thing in setup) fills the unused RAM between the heap and the stack with a known pattern. Later,
+ * the first byte that no longer has that pattern shows how deep the stack has ever gone (the high-water mark), which also gives the minimum
+ * free RAM since boot. Along with that, get_memory_stats reports how full the device db, the address list, the rule arrays, and the name
+ * buffers are (now and, for the rules and names, the most ever used).
+ * 
+ * get_memory_stats is cheap enough to call periodically (it scans the painted area a word at a time). print_memory_stats prints everything.
+ * 
+ *  fine-print: copyright 2021 David Hamilton. This software may be freely copied and used under MIT license (see LICENSE.txt in root directory).
+ */
+
+/*
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MEMSTAT_H
+#define MEMSTAT_H
+
+#include <stdint.h>
+#include "production.h"
+
+// room left below the stack pointer when painting, for the painting function itself and anything it calls
+#define STACK_PAINT_MARGIN 64
+
+typedef struct memory_stats_s {
+  int free_ram;            // between the top of the heap and the stack pointer right now
+  int min_free_ram;        // between the top of the heap and the deepest the stack has been since painting
+  int stack_high_water;    // bytes of stack used at the deepest point since painting (measured from where painting was done)
+  int device_db_records;   // of MAX_RECORDS
+  int addrs;               // of MAX_ADDRS
+  rule_usage_t rules;      // of MAX_RULES each
+  int longest_action_name; // of MAX_ACTION_STRING_SIZE
+  int longest_protocol_name; // of MAX_PROTOCOL_STRING_SIZE
+} memory_stats_t;
+
+void memstat_paint_stack();
+void get_memory_stats(memory_stats_t * stats);
+void print_memory_stats();
+
+#endif
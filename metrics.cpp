@@ -0,0 +1,103 @@
+/*!
+ * @file metrics.cpp
+ * @brief Implementation of the metrics block: updating it, taking snapshots, and exporting them through the relay
+ * @details
+ * Counters that are already kept elsewhere (relay drops, the address list, the device db) are only copied in by metrics_poll, so the
+ * only work added to handling an event is metrics_event_done.
+ *
+ *  fine-print: copyright 2021 David Hamilton. This software may be freely copied and used under MIT license (see LICENSE.txt in root directory).
+ */
+
+/*
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include "metrics.h"
+#include "relay.h"
+#include "addrs.h"
+#include "db.h"
+
+// keeps the compiler from moving the block's reads and writes across the sequence updates
+#define METRICS_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+static metrics_block_t block;     // zeroed; every update stamps the version
+static unsigned long last_export = 0;
+
+static void begin_update() {
+  block.sequence++;
+  METRICS_BARRIER();
+  block.version = METRICS_VERSION;
+}
+
+static void end_update() {
+  METRICS_BARRIER();
+  block.sequence++;
+}
+
+void metrics_event_done(unsigned long start_micros) {
+  unsigned long elapsed = micros() - start_micros;
+  unsigned long limit = 16;
+  int bucket = 0;
+  while ((elapsed >= limit) && (bucket < METRICS_HISTOGRAM_BUCKETS - 1)) {
+    limit <<= 1;
+    bucket++;
+  }
+  begin_update();
+  block.events++;
+  block.event_us_histogram[bucket]++;
+  if (elapsed > block.event_us_max) block.event_us_max = elapsed;
+  end_update();
+}
+
+void metrics_protocol_ended(bool aborted) {
+  begin_update();
+  block.protocols_ended++;
+  if (aborted) block.protocols_aborted++;
+  end_update();
+}
+
+bool metrics_snapshot(metrics_block_t * snapshot) {
+  uint16_t sequence;
+  for (int tries = 0; tries < METRICS_SNAPSHOT_TRIES; tries++) {
+    sequence = *((volatile uint16_t *) &(block.sequence));
+    METRICS_BARRIER();
+    if (sequence & 1) continue;
+    memcpy(snapshot, &block, sizeof(metrics_block_t));
+    METRICS_BARRIER();
+    if (*((volatile uint16_t *) &(block.sequence)) == sequence) return true;
+  }
+  return false;
+}
+
+static void update_summaries() {
+  relay_stats_t relay_stats;
+  tBDAddr addr;
+  int num_addrs = num_addrs_in_list();
+  int first = (num_addrs > METRICS_DEVICES) ? num_addrs - METRICS_DEVICES : 0;
+  int device_index;
+  get_relay_stats(&relay_stats);
+  begin_update();
+  block.uptime_ms = millis();
+  block.relay_dropped = relay_stats.dropped;
+  block.num_devices = num_addrs - first;
+  for (int i = first; i < num_addrs; i++) {
+    metrics_device_t * device = &(block.devices[i - first]);
+    get_addr(i, &addr);
+    memcpy(device->addr, addr, sizeof(device->addr));
+    device->rssi = get_addr_rssi(i);
+    device_index = find_device_in_device_db(addr);
+    device->db_records = (device_index < 0) ? 0 : num_records_for_device_in_device_db(device_index);
+  }
+  end_update();
+}
+
+void metrics_poll() {
+  metrics_block_t snapshot;
+  if (millis() - last_export < METRICS_EXPORT_MS) return;
+  last_export = millis();
+  update_summaries();
+  if (metrics_snapshot(&snapshot)) relay_record(relay_metrics, METRICS_VERSION, 0, (const uint8_t *) &snapshot, sizeof(snapshot));
+}
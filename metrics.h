@@ -0,0 +1,81 @@
+/*!
+ * @file metrics.h
+ * @brief A versioned block of engine metrics that is kept current and exported to a host as one binary relay record.
+ * @details
+ * A monitoring agent on the host would otherwise have to parse the debug output (or the print_..._stats text) to follow the engine,
+ * which costs formatted printing here and parsing there, and lags. Instead the counters, a histogram of event processing times, and
+ * summaries of the latest devices are kept in one fixed layout block (metrics_block_t), and every METRICS_EXPORT_MS metrics_poll sends
+ * a snapshot of it as a relay_metrics record (see relay.h), which the host copies straight into the same struct. Debug text would corrupt
+ * the frames, so relay over a port that gets no debug output, or mute it (DB_mute, see dbprint.h).
+ *
+ * The block is updated with a sequence counter (a seqlock): sequence is made odd before an update and even again after it. Updating
+ * takes no locks and never waits, which matters since it is done for every event, and metrics_snapshot copies the block and only
+ * accepts the copy if sequence was even and didn't change while copying, so a snapshot is never half of one update and half of another,
+ * even if an update happens from an interrupt while copying. The sequence also tells the host how many updates happened between
+ * snapshots.
+ *
+ * This header doesn't need anything from Arduino or the BlueNRG library so that it can be included by the host side reader as is:
+ *     metrics_block_t metrics;
+ *     if (record_type == relay_metrics && metrics_decode(record_value, record_length, &metrics)) ...
+ * metrics_decode checks the size and the version; all fields are little endian, as on the host.
+ *
+ *  fine-print: copyright 2021 David Hamilton. This software may be freely copied and used under MIT license (see LICENSE.txt in root directory).
+ */
+
+/*
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define METRICS_VERSION 1            // changes whenever metrics_block_t changes
+#define METRICS_HISTOGRAM_BUCKETS 12 // bucket 0 is events taking under 16 us, each next bucket twice as long, the last one everything longer
+#define METRICS_DEVICES 8            // summaries of the most recently found devices
+#define METRICS_EXPORT_MS 1000
+#define METRICS_SNAPSHOT_TRIES 4
+
+#define METRICS_PACKED __attribute__((packed))
+
+typedef struct metrics_device_s {
+  uint8_t addr[6];
+  int8_t rssi;                 // best RSSI seen
+  uint8_t unused;
+  uint16_t db_records;         // records in the device db for it (the device, its services, characteristics, values), 0 if not walked
+} METRICS_PACKED metrics_device_t;
+
+typedef struct metrics_block_s {
+  uint16_t version;
+  uint16_t sequence;           // odd while being updated
+  uint32_t uptime_ms;
+  uint32_t events;
+  uint32_t protocols_ended;    // including the aborted ones
+  uint32_t protocols_aborted;
+  uint32_t relay_dropped;
+  uint32_t event_us_max;
+  uint32_t event_us_histogram[METRICS_HISTOGRAM_BUCKETS];
+  uint8_t num_devices;
+  uint8_t unused[3];
+  metrics_device_t devices[METRICS_DEVICES];
+} METRICS_PACKED metrics_block_t;
+
+// engine side (metrics.cpp)
+void metrics_event_done(unsigned long start_micros);
+void metrics_protocol_ended(bool aborted);
+bool metrics_snapshot(metrics_block_t * snapshot);  // false if the block kept changing
+void metrics_poll();                                // refreshes the device summaries and exports a snapshot every METRICS_EXPORT_MS
+
+// host side
+static inline bool metrics_decode(const uint8_t * value, int len, metrics_block_t * metrics) {
+  if (len != (int) sizeof(metrics_block_t)) return false;
+  memcpy(metrics, value, sizeof(metrics_block_t));
+  return (metrics->version == METRICS_VERSION) && ((metrics->sequence & 1) == 0);
+}
+
+#endif
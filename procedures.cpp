@@ -89,10 +89,192 @@ bool start_observer_scan() {
 
 bool start_observation(DUMMY_ARG) {
   if (!set_role_to_observer()) return false;
+  remember_stack_configuration(set_role_to_observer);
   if (!start_observer_scan()) return false;
   return true;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+// monitoring scan: an observer scan filtered by the controller's whitelist
+
+// According to [c], 0x00: accept all advertising packets, 0x01: only accept those from devices in the whitelist
+#define WHITELIST_ONLY 0x01
+
+typedef struct monitor_target_s {
+  tBDAddr addr;
+  bool public_addr;
+  bool in_controller;   // the controller's whitelist has it
+  bool removed;         // to be taken out of the controller's whitelist at the next commit
+} monitor_target_t;
+
+static monitor_target_t monitor_targets[MAX_MONITOR_TARGETS];
+static int num_targets = 0;     // including removed ones not committed yet
+static bool monitor_scanning = false;
+
+static int find_monitor_target(tBDAddr addr) {
+  for (int i = 0; i < num_targets; i++) {
+    if (memcmp(monitor_targets[i].addr, addr, sizeof(tBDAddr)) == 0) return i;
+  }
+  return -1;
+}
+
+bool add_monitor_target(tBDAddr addr, bool public_addr) {
+  int i = find_monitor_target(addr);
+  if (i >= 0) {
+    if (monitor_targets[i].public_addr != public_addr) {
+      // a different address type is a different whitelist entry; take the old one out before adding it back
+      if (monitor_targets[i].in_controller) {
+        DBMSG(DBL_ERRORS, "*** commit the removal of a monitor target before adding it with another address type")
+        return false;
+      }
+      monitor_targets[i].public_addr = public_addr;
+    }
+    monitor_targets[i].removed = false;
+    return true;
+  }
+  if (num_targets >= MAX_MONITOR_TARGETS) {
+    DBMSG(DBL_ERRORS, "*** too many monitor targets")
+    return false;
+  }
+  memcpy(monitor_targets[num_targets].addr, addr, sizeof(tBDAddr));
+  monitor_targets[num_targets].public_addr = public_addr;
+  monitor_targets[num_targets].in_controller = false;
+  monitor_targets[num_targets].removed = false;
+  num_targets++;
+  return true;
+}
+
+bool remove_monitor_target(tBDAddr addr) {
+  int i = find_monitor_target(addr);
+  if (i < 0) return false;
+  if (monitor_targets[i].in_controller) monitor_targets[i].removed = true;
+  else monitor_targets[i] = monitor_targets[--num_targets];
+  return true;
+}
+
+int num_monitor_targets() {
+  int count = 0;
+  for (int i = 0; i < num_targets; i++) {
+    if (!monitor_targets[i].removed) count++;
+  }
+  return count;
+}
+
+static bool monitor_targets_committed() {
+  for (int i = 0; i < num_targets; i++) {
+    if (monitor_targets[i].removed || !monitor_targets[i].in_controller) return false;
+  }
+  return true;
+}
+
+static bool set_monitor_scan_enable(uint8_t enable) {
+  tBleStatus ret = hci_le_set_scan_enable(enable, DO_NOT_FILTER_DUPLICATES);
+  if (ret != BLE_STATUS_SUCCESS) {
+    DBMSG(DBL_ERRORS, enable ? "*** failure to start monitor scan" : "*** failure to stop monitor scan")
+    DBPR(DBL_ERRORS, ret, "%d", "return code");
+    return false;
+  }
+  return true;
+}
+
+// brings the controller's whitelist up to date; the scan must not be running
+static bool update_whitelist() {
+  tBleStatus ret;
+  int i = 0;
+  bool success = true;
+  while (i < num_targets) {
+    monitor_target_t * target = &(monitor_targets[i]);
+    if (target->removed) {
+      ret = target->in_controller ? hci_le_remove_device_from_white_list(target->public_addr ? PUBLIC_ADDR : RANDOM_ADDR, target->addr) : BLE_STATUS_SUCCESS;
+      if (ret != BLE_STATUS_SUCCESS) {
+        DBPR(DBL_ERRORS, ret, "%d", "*** failure to remove monitor target from whitelist, return code")
+        success = false;
+      }
+      *target = monitor_targets[--num_targets];   // gone locally either way, and this slot now has an unchecked target
+      continue;
+    }
+    if (!target->in_controller) {
+      ret = hci_le_add_device_to_white_list(target->public_addr ? PUBLIC_ADDR : RANDOM_ADDR, target->addr);
+      if (ret != BLE_STATUS_SUCCESS) {
+        DBPR(DBL_ERRORS, ret, "%d", "*** failure to add monitor target to whitelist, return code")
+        success = false;
+      }
+      else target->in_controller = true;
+    }
+    i++;
+  }
+  return success;
+}
+
+bool commit_monitor_targets() {
+  bool success;
+  if (monitor_targets_committed()) return true;
+  if (monitor_scanning && !set_monitor_scan_enable(0)) return false;
+  success = update_whitelist();
+  if (monitor_scanning && !set_monitor_scan_enable(1)) return false;
+  return success;
+}
+
+// loads the whitelist and the scan parameters into a controller that already has its GAP role; doesn't start scanning
+static bool load_monitor_scan() {
+  tBleStatus ret;
+  ret = hci_le_clear_white_list();
+  if (ret != BLE_STATUS_SUCCESS) {
+    DBPR(DBL_ERRORS, ret, "%d", "*** failure to clear whitelist, return code")
+    return false;
+  }
+  for (int i = 0; i < num_targets; i++) monitor_targets[i].in_controller = false;
+  if (!update_whitelist()) return false;
+  ret = hci_le_set_scan_parameters(PASSIVE_SCAN, TIME_BETWEEN_SCANS, TIME_TO_SCAN, PUBLIC_ADDR, WHITELIST_ONLY);
+  if (ret != BLE_STATUS_SUCCESS) {
+    DBPR(DBL_ERRORS, ret, "%d", "*** failure to set monitor scan parameters, return code")
+    return false;
+  }
+  return true;
+}
+
+// the stack configuration in place when the monitor scan started, put back when it stops
+static stack_configuration_t * configuration_before_monitor = NULL;
+
+// sets the monitor scan up again after a reset, which also clears the GAP role and the controller's whitelist; it doesn't start
+// scanning since the protocol using the scan is aborted by the reset, and a scan nobody is waiting on would never be stopped
+static bool configure_monitor_scan() {
+  monitor_scanning = false;
+  if (configuration_before_monitor) {
+    if (!(*configuration_before_monitor)()) return false;
+  }
+  else if (!set_role_to_observer()) return false;
+  return load_monitor_scan();
+}
+
+bool start_monitor_scan(DUMMY_ARG) {
+  if (num_monitor_targets() == 0) {
+    // with an empty whitelist the controller would pass on nothing at all
+    DBMSG(DBL_ERRORS, "*** no monitor targets to scan for")
+    return false;
+  }
+  // the controller rejects changes to the whitelist and scan parameters while scanning
+  if (monitor_scanning && !set_monitor_scan_enable(0)) return false;
+  monitor_scanning = false;
+  if (get_stack_configuration() != configure_monitor_scan) {
+    configuration_before_monitor = get_stack_configuration();
+    remember_stack_configuration(configure_monitor_scan);
+  }
+  if (!load_monitor_scan()) return false;
+  if (!set_monitor_scan_enable(1)) return false;
+  monitor_scanning = true;
+  DBMSG(DBL_HAL_EVENTS, "started monitor scan")
+  return true;
+}
+
+bool stop_monitor_scan(DUMMY_ARG) {
+  // put back the configuration even when a reset already stopped the scan
+  if (get_stack_configuration() == configure_monitor_scan) remember_stack_configuration(configuration_before_monitor);
+  if (!monitor_scanning) return true;
+  monitor_scanning = false;
+  return set_monitor_scan_enable(0);
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -152,6 +334,7 @@ bool start_general_discovery() {
 
 bool start_directed_scan(DUMMY_ARG) {
   if (!set_role_central()) return false;
+  remember_stack_configuration(set_role_central);
   if (!start_general_discovery()) return false;
   return true;
   set_role_central();
@@ -243,9 +426,11 @@ bool terminate_connection(arg_t ptr_to_connection_handle) {
     DBMSG(DBL_ERRORS, "*** Terminate connection failed.")
     DBPR(DBL_ERRORS, ret, "%d\n", "Return code")
     hci_print_ret(ret);
+    return false;
   } 
   else {
     DBMSG(DBL_HAL_EVENTS, "Terminate Connection succeeded.")
+    return true;
   }
 }
 
@@ -257,9 +442,11 @@ bool terminate_gap_procedure(arg_t ptr_to_procedure_code) {
     DBMSG(DBL_ERRORS, "*** Terminate gap procedure failed.")
     DBPR(DBL_ERRORS, ret, "%d\n", "Return code")
     hci_print_ret(ret);
+    return false;
   } 
   else {
     DBMSG(DBL_HAL_EVENTS, "Terminate Connection succeeded.")
+    return true;
   }
 }
 
@@ -323,3 +510,151 @@ bool discover_characteristcs(arg_t attribute_info) {
       return false;
   };
 }
+
+bool read_characteristic_value(arg_t read_request) {
+  tBleStatus ret;
+  read_request_t * request = (read_request_t *) read_request;
+  request->result.connection_handle = request->connection_handle;
+  request->result.handle = request->handle;
+  request->result.len = 0;
+  ret = aci_gatt_read_charac_val(request->connection_handle, request->handle);
+  switch (ret) {
+    case BLE_STATUS_TIMEOUT: 
+      DBMSG(DBL_HAL_EVENTS, "read characteristic value had a timeout, continuing.")
+      return true;
+    case BLE_STATUS_SUCCESS:
+      DBMSG(DBL_HAL_EVENTS, "read characteristic value succeeded.")
+      return true;
+    default:
+      DBMSG(DBL_ERRORS, "*** read characteristic value failed.")
+      hci_print_ret(ret);
+      return false;
+  };
+}
+
+bool get_read_response(hci_event_pckt *event_pckt, arg_t read_request) {
+  evt_blue_aci *evt_blue;
+  evt_att_read_resp * read_resp;
+  read_request_t * request = (read_request_t *) read_request;
+  int i;
+  if (event_pckt->evt == EVT_VENDOR) {
+    evt_blue = (evt_blue_aci *) (event_pckt->data);
+    if (evt_blue->ecode == EVT_BLUE_ATT_READ_RESP) {
+      read_resp = (evt_att_read_resp *) evt_blue->data;
+      request->result.len = (read_resp->event_data_length < MAX_VALUE_LEN) ? read_resp->event_data_length : MAX_VALUE_LEN;
+      for (i = 0; i < request->result.len; i++) request->result.value[i] = read_resp->attribute_value[i];
+      return true;
+    }
+  }
+  DBMSG(DBL_ERRORS, "get_read_response called on wrong event")
+  return false;
+}
+
+bool read_using_uuid(arg_t read_by_uuid_request) {
+  tBleStatus ret;
+  read_by_uuid_request_t * request = (read_by_uuid_request_t *) read_by_uuid_request;
+  request->result.connection_handle = request->connection_handle;
+  request->result.handle = 0;
+  request->result.len = 0;
+  request->num_results = 0;
+  ret = aci_gatt_read_using_charac_uuid(request->connection_handle, request->start_handle, request->end_handle, 
+                                        request->uuid.is_16_bit ? UUID_TYPE_16 : UUID_TYPE_128, request->uuid.bytes);
+  switch (ret) {
+    case BLE_STATUS_TIMEOUT: 
+      DBMSG(DBL_HAL_EVENTS, "read using uuid had a timeout, continuing.")
+      return true;
+    case BLE_STATUS_SUCCESS:
+      DBMSG(DBL_HAL_EVENTS, "read using uuid succeeded.")
+      return true;
+    default:
+      DBMSG(DBL_ERRORS, "*** read using uuid failed.")
+      hci_print_ret(ret);
+      return false;
+  };
+}
+
+bool get_read_by_uuid_response(hci_event_pckt *event_pckt, arg_t read_by_uuid_request) {
+  evt_blue_aci *evt_blue;
+  evt_gatt_disc_read_char_by_uuid_resp * resp;
+  read_by_uuid_request_t * request = (read_by_uuid_request_t *) read_by_uuid_request;
+  int len, i;
+  if (event_pckt->evt == EVT_VENDOR) {
+    evt_blue = (evt_blue_aci *) (event_pckt->data);
+    if (evt_blue->ecode == EVT_BLUE_GATT_DISC_READ_CHAR_BY_UUID_RESP) {
+      resp = (evt_gatt_disc_read_char_by_uuid_resp *) evt_blue->data;
+      // event_data_length includes the attribute handle
+      len = resp->event_data_length - 2;
+      if (len < 0) len = 0;
+      request->result.handle = resp->attr_handle;
+      request->result.len = (len < MAX_VALUE_LEN) ? len : MAX_VALUE_LEN;
+      for (i = 0; i < request->result.len; i++) request->result.value[i] = resp->attr_value[i];
+      request->num_results++;
+      return true;
+    }
+  }
+  DBMSG(DBL_ERRORS, "get_read_by_uuid_response called on wrong event")
+  return false;
+}
+
+static sweep_read_t * current_sweep = NULL;   // for the until condition, which has no argument
+
+void set_sweep_read(sweep_read_t * sweep, uint16_t connection_handle, uuid_t * uuid, int device_index) {
+  sweep->request.connection_handle = connection_handle;
+  sweep->request.start_handle = 0x0001;
+  sweep->request.end_handle = 0xFFFF;
+  copy_uuid(uuid, &(sweep->request.uuid));
+  set_context(&(sweep->context), db_value, PARENT(device_index), connection_handle);
+}
+
+bool start_sweep_read(arg_t sweep_read) {
+  sweep_read_t * sweep = (sweep_read_t *) sweep_read;
+  current_sweep = sweep;
+  sweep->values = 0;
+  sweep->requests = 1;
+  sweep->done = false;
+  if (!is_last_device_in_device_db(sweep->context.parent)) {
+    // the values would be listed under whatever device was added after it
+    DBMSG(DBL_ERRORS, "*** sweep read is only possible for the last device in the device db")
+    sweep->done = true;
+    return false;
+  }
+  return read_using_uuid(&(sweep->request));
+}
+
+bool add_sweep_read_value(hci_event_pckt *event_pckt, arg_t sweep_read) {
+  sweep_read_t * sweep = (sweep_read_t *) sweep_read;
+  if (!get_read_by_uuid_response(event_pckt, &(sweep->request))) return false;
+  if (!is_last_device_in_device_db(sweep->context.parent)) {
+    DBMSG(DBL_ERRORS, "*** device added during sweep read, dropping value")
+    return false;
+  }
+  sweep->values++;
+  return add_device_db_entry_from_event(event_pckt, &(sweep->context));
+}
+
+// one request has completed; carry on after the last handle it found, or stop if it found nothing
+bool continue_sweep_read(hci_event_pckt *event_pckt, arg_t sweep_read) {
+  sweep_read_t * sweep = (sweep_read_t *) sweep_read;
+  uint16_t last_handle = sweep->request.result.handle;
+  if ((sweep->request.num_results == 0) || (last_handle >= sweep->request.end_handle)) {
+    sweep->done = true;
+    return true;
+  }
+  sweep->request.start_handle = last_handle + 1;
+  sweep->requests++;
+  if (!read_using_uuid(&(sweep->request))) {
+    sweep->done = true;
+    return false;
+  }
+  return true;
+}
+
+bool sweep_read_done(hci_event_pckt *event_pckt) {
+  return current_sweep && current_sweep->done;
+}
+
+void print_sweep_read_savings(sweep_read_t * sweep) {
+  int saved = (sweep->values > sweep->requests) ? sweep->values - sweep->requests : 0;
+  PRINTF("sweep read %d values in %d requests; ", sweep->values, sweep->requests)
+  PRINTF("reading each handle would take %d reads (after discovery to find them), so %d round trips saved\n", sweep->values, saved)
+}
@@ -21,11 +21,36 @@
 #include <STBLE.h>
 #include "production.h"
 #include "get_data.h"
+#include "db.h"
 
 bool start_observation(DUMMY_ARG);
 
 bool start_directed_scan(DUMMY_ARG);
 
+/*
+ * Monitoring scan: an observer scan where the controller only passes on reports from a set of target devices (its whitelist), so
+ * reports from every other advertiser around never cross the SPI link or wake up the event handling. The targets are kept here and
+ * changes are batched: add and remove only change the local list, and commit_monitor_targets brings the controller's whitelist up to
+ * date with as few commands as it can, pausing the scan once for the whole batch since the whitelist can't change while it is used.
+ * start_monitor_scan leaves the GAP role alone, so the stack must already have one (e.g. from set_role_to_observer):
+ *     add_monitor_target(addr1, true);
+ *     add_monitor_target(addr2, true);
+ *     PERFORM(start_monitor_scan, NO_ARGS)
+ *       expect(event_check, SPECIFICALLY(EVT_LE_META_EVENT), AND_DO(...), WITH(...));
+ *       until(timeout);
+ * The scan runs until stop_monitor_scan, which also puts back the stack configuration that was in place when it started. After a
+ * controller reset the role, whitelist and scan parameters are set up again (see HCI.h), but the scan is not restarted, since the
+ * reset aborts the protocol that was using it; call start_monitor_scan again when resuming.
+ */
+#define MAX_MONITOR_TARGETS 8   // controller whitelists are small
+
+bool add_monitor_target(tBDAddr addr, bool public_addr);
+bool remove_monitor_target(tBDAddr addr);
+int num_monitor_targets();
+bool commit_monitor_targets();   // a no-op if nothing changed since the last commit
+action_t start_monitor_scan;     // commits the targets and starts scanning with the whitelist only filter policy
+action_t stop_monitor_scan;
+
 action_t start_connection; /* pass pointer to address to connect to as void * */
 action_t terminate_connection; /* argument should be (arg_t) &connection_handle */
 action_t terminate_gap_procedure; 
@@ -48,4 +73,47 @@ bool discover_included_services(arg_t attribute_info);
 
 bool discover_characteristcs(arg_t attribute_info);
 
+// reading a characteristic value: fill in connection_handle and handle, and the value ends up in result
+typedef struct read_request_s {
+  uint16_t connection_handle;
+  uint16_t handle;
+  handle_value_pair_t result;
+} read_request_t;
+
+bool read_characteristic_value(arg_t read_request);   // should result in EVT_BLUE_ATT_READ_RESP then EVT_BLUE_GATT_PROCEDURE_COMPLETE
+event_action_t get_read_response;                     // argument is the same read_request_t
+
+// reading by UUID: fill in connection_handle, the handle range (usually 0x0001 to 0xFFFF), and the characteristic uuid; the values 
+// are found and read in one ATT request, without discovering services or characteristics first. The last value found ends up in result.
+typedef struct read_by_uuid_request_s {
+  uint16_t connection_handle;
+  uint16_t start_handle;
+  uint16_t end_handle;
+  uuid_t uuid;
+  handle_value_pair_t result;
+  int num_results;
+} read_by_uuid_request_t;
+
+bool read_using_uuid(arg_t read_by_uuid_request);     // should result in EVT_BLUE_GATT_DISC_READ_CHAR_BY_UUID_RESP for each value then EVT_BLUE_GATT_PROCEDURE_COMPLETE
+event_action_t get_read_by_uuid_response;             // argument is the same read_by_uuid_request_t
+
+// sweep reading: every value of one characteristic type on a device (e.g., all battery levels), with read by uuid requests from the
+// start of the device's handle range, each carrying on after the last handle found, until one finds nothing. The values are added to
+// the device db (as db_value records of the device). Use set_sweep_read to fill it in, then AWAIT_SWEEP_READ (see await.h). Records are
+// grouped under a device by position, so the device has to be the last one in the db (e.g., the one being walked) or the sweep fails.
+typedef struct sweep_read_s {
+  read_by_uuid_request_t request;
+  attribute_context_t context;
+  int values;       // values found
+  int requests;     // read by uuid requests (round trips) it took
+  bool done;
+} sweep_read_t;
+
+void set_sweep_read(sweep_read_t * sweep, uint16_t connection_handle, uuid_t * uuid, int device_index);
+bool start_sweep_read(arg_t sweep_read);              // PERFORM action
+event_action_t add_sweep_read_value;                  // for EVT_BLUE_GATT_DISC_READ_CHAR_BY_UUID_RESP
+event_action_t continue_sweep_read;                   // for EVT_BLUE_GATT_PROCEDURE_COMPLETE
+bool sweep_read_done(hci_event_pckt *event_pckt);     // until condition
+void print_sweep_read_savings(sweep_read_t * sweep);  // round trips compared with reading each handle
+
 #endif
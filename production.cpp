@@ -26,6 +26,8 @@
 #include <stddef.h>
 #include "production.h"
 #include "dbprint.h"
+#include "recorder.h"
+#include "trace.h"
 
 typedef struct rule_s {
   check_t check_type;
@@ -33,20 +35,137 @@ typedef struct rule_s {
   event_condition_ptr_t event_condition;
   event_action_ptr_t event_action;
   arg_t action_args;
+  int8_t condition_timing;   // index into action_timings, or -1 if not timed
+  int8_t action_timing;
 } rule_t;
 
+/////////////////////////////////////////////////////////////
+// execution times
+
+static action_timing_t action_timings[MAX_TIMED_ACTIONS];
+static int num_action_timings = 0;
+
+// finds (or starts) the timing for a function; done when rules are set, so timing each run is just an index
+static int8_t timing_for(const void * function, const char * name) {
+  int i;
+  if (!function) return -1;
+  for (i = 0; i < num_action_timings; i++) {
+    if (action_timings[i].function == function) {
+      if (name && !action_timings[i].name) action_timings[i].name = name;
+      return i;
+    }
+  }
+  if (num_action_timings == MAX_TIMED_ACTIONS) return -1;
+  memset(&(action_timings[num_action_timings]), 0, sizeof(action_timing_t));
+  action_timings[num_action_timings].function = function;
+  action_timings[num_action_timings].name = name;
+  return num_action_timings++;
+}
+
+void set_action_budget(const void * function, const char * name, unsigned long microseconds, bool may_defer) {
+  int8_t t = timing_for(function, name);
+  if (t < 0) {
+    DBMSG(DBL_ERRORS, "ERROR: exceeded max number of timed actions")
+    return;
+  }
+  action_timings[t].budget = microseconds;
+  action_timings[t].may_defer = may_defer;
+}
+
+static void record_time(int8_t t, unsigned long start) {
+  unsigned long elapsed_us;
+  action_timing_t * timing;
+  if (t < 0) return;
+  elapsed_us = micros() - start;
+  timing = &(action_timings[t]);
+  timing->runs++;
+  if (elapsed_us > timing->max_time) timing->max_time = elapsed_us;
+  if (timing->budget && (elapsed_us > timing->budget)) {
+    timing->overruns++;
+    DBPR(DBL_ERRORS, elapsed_us, "%lu", timing->name ? timing->name : "unnamed action")
+  }
+}
+
+static bool should_defer(int8_t t) {
+  if (t < 0) return false;
+  return action_timings[t].may_defer && (action_timings[t].overruns >= DEFER_AFTER_OVERRUNS);
+}
+
+typedef struct deferred_event_s {
+  event_action_ptr_t event_action;
+  arg_t action_args;
+  int8_t action_timing;
+  uint8_t pckt[HCI_READ_PACKET_SIZE];
+} deferred_event_t;
+
+static deferred_event_t deferred_events[MAX_DEFERRED_EVENTS];
+static int first_deferred_event = 0;
+static int num_deferred_events = 0;
+
+// returns false if there was no room, in which case the action has to be run now
+static bool defer_action(rule_t * r, hci_event_pckt *event_pckt) {
+  deferred_event_t * d;
+  int len = 2 + event_pckt->plen;
+  if (num_deferred_events == MAX_DEFERRED_EVENTS) return false;
+  d = &(deferred_events[(first_deferred_event + num_deferred_events) % MAX_DEFERRED_EVENTS]);
+  d->event_action = r->event_action;
+  d->action_args = r->action_args;
+  d->action_timing = r->action_timing;
+  memcpy(d->pckt, event_pckt, (len < HCI_READ_PACKET_SIZE) ? len : HCI_READ_PACKET_SIZE);
+  num_deferred_events++;
+  return true;
+}
+
+void run_deferred_actions() {
+  deferred_event_t * d;
+  while (num_deferred_events) {
+    d = &(deferred_events[first_deferred_event]);
+    d->event_action((hci_event_pckt *) d->pckt, d->action_args);
+    if (d->action_timing >= 0) action_timings[d->action_timing].deferred++;
+    first_deferred_event = (first_deferred_event + 1) % MAX_DEFERRED_EVENTS;
+    num_deferred_events--;
+  }
+}
+
+void print_action_timing() {
+  int i;
+  action_timing_t * t;
+  for (i = 0; i < num_action_timings; i++) {
+    t = &(action_timings[i]);
+    if (t->name) PRINTF("%s: ", t->name)
+    else PRINTF("action %p: ", t->function)
+    PRINTF("%lu runs, max %lu us, budget %lu us, ", t->runs, t->max_time, t->budget)
+    PRINTF("%lu overruns, %lu deferred\n", t->overruns, t->deferred)
+  }
+}
+
+/////////////////////////////////////////////////////////////
+
 static action_ptr_t action = NULL;
 static void * action_args = NULL;
+static const char * action_name_source = "";  // the string literal given by PERFORM, which stays around for the flight recorder
+static int longest_action_name = 0;
+static const char * traced_production = NULL;  // name of the production being traced, until its until condition is met
 void perform(action_ptr_t act, void * args) {
   action = act;
   action_args = args;
 }
 bool run_action_only_once() {
   bool ret;
+  int8_t timing;
+  unsigned long start;
   if (action) {
+    timing = timing_for((const void *) action, action_name_source);
+    traced_production = action_name_source;
+    trace_begin(trace_production, traced_production, 0);
+    trace_begin(trace_action, action_name_source, 0);
+    start = micros();
     ret = (*action)(action_args);
+    record_time(timing, start);
+    trace_end(trace_action, action_name_source, 0);
     if (ret) PRINTF("action %s returned true\n", get_action_name())
     else  PRINTF("action %s returned false\n", get_action_name())
+    record_action(action_name_source, ret);
     action = NULL;
     action_args = NULL;
   }
@@ -56,8 +175,12 @@ bool run_action_only_once() {
 
 char action_name[MAX_ACTION_STRING_SIZE];
 void set_action_name(char * act_name) {
+  int len = strlen(act_name);
   strncpy(action_name, act_name, MAX_ACTION_STRING_SIZE);
+  action_name_source = act_name;
+  if (len > longest_action_name) longest_action_name = len;
 }
+int get_longest_action_name() { return longest_action_name; }
 char * get_action_name() {
   return action_name;
 }
@@ -68,6 +191,8 @@ void until(until_ptr_t until_function) {
 }
 void until_clear() {
   until_condition = NULL;
+  if (traced_production) trace_end(trace_production, traced_production, 0);
+  traced_production = NULL;
 }
 
 static check_t until_check = no_check;
@@ -100,6 +225,10 @@ bool met_expectations() {
   return rule_matched;
 }
 
+void set_met_expectations(bool met) {
+  rule_matched = met;
+}
+
 /////////////////////////////////////////////////////////////////////
 //rules arrays: tbd: something more flexible than fixed length arrays
 /////////////////////////////////////////////////////////////////////
@@ -113,6 +242,19 @@ int num_global_rules = 0;
 int current_rule;
 int current_global_rule;
 int current_exclusive_rule;
+// most rules ever in use, to see how close to MAX_RULES things get
+static int max_num_rules = 0;
+static int max_num_exclusive_rules = 0;
+static int max_num_global_rules = 0;
+
+void rule_usage(rule_usage_t * usage) {
+  usage->rules = num_rules;
+  usage->exclusive_rules = num_exclusive_rules;
+  usage->global_rules = num_global_rules;
+  usage->max_rules = max_num_rules;
+  usage->max_exclusive_rules = max_num_exclusive_rules;
+  usage->max_global_rules = max_num_global_rules;
+}
 
 void rules_clear() {
   num_rules = 0;
@@ -151,26 +293,29 @@ bool global_rules_done() {
 }
 
 rule_t * new_rule() {
-  if (current_rule == MAX_RULES) {
+  if (num_rules == MAX_RULES) {
     DBMSG(DBL_ERRORS, "ERROR: exceeded max number of rules")
     return NULL;
   }
+  if (num_rules == max_num_rules) max_num_rules++;
   return &(rules[num_rules++]);
 }
 
 rule_t * new_exclusive_rule() {
-  if (current_exclusive_rule == MAX_RULES) {
+  if (num_exclusive_rules == MAX_RULES) {
     DBMSG(DBL_ERRORS, "ERROR: exceeded max number of exclusive rules")
     return NULL;
   }
+  if (num_exclusive_rules == max_num_exclusive_rules) max_num_exclusive_rules++;
   return &(exclusive_rules[num_exclusive_rules++]);
 }
 
 rule_t * new_global_rule() {
-  if (current_global_rule == MAX_RULES) {
+  if (num_global_rules == MAX_RULES) {
     DBMSG(DBL_ERRORS, "ERROR: exceeded max number of global rules")
     return NULL;
   }
+  if (num_global_rules == max_num_global_rules) max_num_global_rules++;
   return &(global_rules[num_global_rules++]);
 }
 
@@ -217,6 +362,8 @@ void set_expect(rule_t * r, check_t check_type, uint16_t event_code, event_actio
   r->event_condition = NULL;
   r->event_action = event_action;
   r->action_args = action_args;
+  r->condition_timing = -1;
+  r->action_timing = timing_for((const void *) event_action, NULL);
 }
 
 void set_expect_condition(rule_t * r, event_condition_t event_condition, event_action_ptr_t event_action, arg_t action_args) {
@@ -226,6 +373,8 @@ void set_expect_condition(rule_t * r, event_condition_t event_condition, event_a
   r->event_condition = event_condition;
   r->event_action = event_action;
   r->action_args = action_args;
+  r->condition_timing = timing_for((const void *) event_condition, NULL);
+  r->action_timing = timing_for((const void *) event_action, NULL);
 }
 
 void expect(check_t check_type, uint16_t event_code, event_action_ptr_t event_action, arg_t action_args) {
@@ -305,15 +454,25 @@ bool check4event(hci_event_pckt *event_pckt, check_t check_type, uint16_t event_
 
 bool fire_rule(rule_t *r, hci_event_pckt *event_pckt) {
   bool do_action;
+  unsigned long start;
   if (r->check_type == condition_check) {
+    start = micros();
     if (r->event_condition && r->event_condition(event_pckt) ) do_action = true;
     else do_action = false;
+    record_time(r->condition_timing, start);
   }
   else {
     do_action = check4event(event_pckt, r->check_type, r->event_code);
   }
   if (do_action) {
-    if (r->event_action) r->event_action(event_pckt, r->action_args);
+    if (r->event_action) {
+      if (should_defer(r->action_timing) && defer_action(r, event_pckt)) return do_action;
+      trace_begin(trace_action, "expect action", r->event_code);
+      start = micros();
+      r->event_action(event_pckt, r->action_args);
+      record_time(r->action_timing, start);
+      trace_end(trace_action, "expect action", r->event_code);
+    }
   }
   return do_action;
 }
@@ -113,6 +113,7 @@ void expect_globally(check_t check_type, uint16_t event_code, event_action_ptr_t
 void expect_globally_condition(event_condition_t event_function, event_action_ptr_t event_action, arg_t action_args);
 
 bool met_expectations();
+void set_met_expectations(bool met);   // for putting back a suspended protocol's result when it resumes (see protocol.h)
 
 /* until condition */
 
@@ -139,6 +140,43 @@ bool run_action_only_once();
 #define MAX_ACTION_STRING_SIZE 40
 void set_action_name(char * act_name);
 char * get_action_name();
+int get_longest_action_name();  // names longer than MAX_ACTION_STRING_SIZE-1 get cut off
+
+/* fill levels of the rule arrays, now and the most ever used */
+typedef struct rule_usage_s {
+  int rules, exclusive_rules, global_rules;
+  int max_rules, max_exclusive_rules, max_global_rules;
+} rule_usage_t;
+void rule_usage(rule_usage_t * usage);
+
+/* execution times of actions and conditions
+ * Every PERFORM action, expect action, and expect condition is timed. A budget (in us) can be given for any of them; runs over the budget
+ * are counted as overruns. An expect action that may be deferred is, after DEFER_AFTER_OVERRUNS overruns, no longer run inside the
+ * event callback but on a copy of the event from run_deferred_actions (call it from loop). Only defer actions whose results the
+ * protocol doesn't need right away (e.g., displaying or relaying data); PERFORM actions and conditions are never deferred.
+ *     BUDGET(add_device_db_entry_from_event, 2000)
+ *     BUDGET_OR_DEFER(display_event, 500)
+ */
+#define MAX_TIMED_ACTIONS 16
+#define DEFER_AFTER_OVERRUNS 3
+#define MAX_DEFERRED_EVENTS 4
+#define BUDGET(fn, microseconds) set_action_budget((const void *) fn, #fn, microseconds, false);
+#define BUDGET_OR_DEFER(fn, microseconds) set_action_budget((const void *) fn, #fn, microseconds, true);
+
+typedef struct action_timing_s {
+  const void * function;
+  const char * name;          // NULL for expect actions and conditions without a budget
+  unsigned long budget;       // us, 0 for none
+  unsigned long runs;
+  unsigned long max_time;     // us
+  unsigned long overruns;
+  unsigned long deferred;     // runs done from run_deferred_actions
+  bool may_defer;
+} action_timing_t;
+
+void set_action_budget(const void * function, const char * name, unsigned long microseconds, bool may_defer);
+void run_deferred_actions();
+void print_action_timing();
 
 /* until condition */
 void until_clear();
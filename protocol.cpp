@@ -9,7 +9,10 @@
  *       run_current_protocol(pckt);
  *     }
  *     
- * There is only one protocol allowed to be running at a time (captured in a static variable used by the framework).
+ * There is only one protocol allowed to be running at a time (captured in a static variable used by the framework). Protocols of
+ * a lower priority can be suspended to let a higher priority one run (see request_protocol in protocol.h). Suspending only happens
+ * when the current production has finished, i.e., just before the protocol's next step would be called, so a suspended protocol
+ * is resumed by calling that step, after setting it as the current protocol again so that its state isn't reset.
  * 
  * The remaining functions are supporting functions by the framework, used automatically by the macros in production.h
  * 
@@ -25,27 +28,54 @@
 #include "protocol.h"
 #include "production.h"
 #include "dbprint.h"
+#include "recorder.h"
+#include "trace.h"
+#include "metrics.h"
 
 static protocol_ptr_t current_protocol;
+static const char * protocol_name_source = "";  // the string literal given by BEGIN_PROTOCOL, which stays around for the flight recorder
+char protocol_name[MAX_PROTOCOL_STRING_SIZE];
+static action_ptr_t abort_action = NULL;
+static void * abort_action_args = NULL;
+static protocol_priority_t current_priority = priority_background;
+
+typedef struct suspended_protocol_s {
+  protocol_ptr_t protocol;
+  const char * name_source;
+  action_ptr_t abort_action;
+  void * abort_action_args;
+  protocol_priority_t priority;
+  bool met_expectations;
+} suspended_protocol_t;
+
+static suspended_protocol_t suspended[MAX_SUSPENDED_PROTOCOLS];
+static int num_suspended = 0;
+static bool resume_pending = false;     // the current protocol's production is done and its next step hasn't been called yet
+static protocol_ptr_t waiting_protocol = NULL;
+static protocol_priority_t waiting_priority;
+static unsigned long waiting_since;
+static unsigned int num_preemptions = 0;
+static unsigned long max_preemption_wait = 0;   // ms from request_protocol to the protocol starting
+
+static bool aborting = false;   // so clear_current_protocol can tell an abort from the protocol finishing
+
+static void run_pending_protocols();
 
 void run_current_protocol(void *pckt) {
   int production_result;
-  bool protocol_is_working;
-  protocol_ptr_t current_protocol;
+  unsigned long event_start = micros();
   DBMSG(DBL_DECODED_EVENTS, "----------------------------------------------------------")
   DBBUFF(DBL_RAW_EVENT_DATA, pckt)
+  if (((hci_uart_pckt *) pckt)->type == HCI_EVENT_PKT) {
+    record_event((hci_event_pckt *) ((hci_uart_pckt *) pckt)->data);
+    trace_event_begin((hci_event_pckt *) ((hci_uart_pckt *) pckt)->data);
+  }
   production_result = run_production(pckt);
   switch (production_result) {
     case 0:  
       DBMSG(DBL_ALL_BLE_EVENTS, "current production finished")  
-      current_protocol = get_current_protocol();
-      if (current_protocol) {
-        protocol_is_working = (*current_protocol)();
-        if (!protocol_is_working) {
-          PRINTF("current protocol encountered an error - clearing current protocol\n")
-          clear_current_protocol();
-        }
-      }
+      // the next step is called by run_pending_protocols, unless a higher priority protocol is waiting to go first
+      if (get_current_protocol()) resume_pending = true;
       else PRINTF("no current protocol to call\n");
       break;
     case -1:
@@ -57,6 +87,10 @@ void run_current_protocol(void *pckt) {
     default:
       DBMSG(DBL_ALL_BLE_EVENTS, "current production returned unexpected result")  
   };
+  run_pending_protocols();
+  if (((hci_uart_pckt *) pckt)->type == HCI_EVENT_PKT) trace_event_end();
+  record_event_done(event_start);
+  metrics_event_done(event_start);
 }
 
 void set_current_protocol(protocol_ptr_t protocol) {
@@ -72,17 +106,141 @@ void clear_current_protocol() {
     clear_exclusive_expectations(); 
     until_clear();                  
     until_event_clear();            
+    if (current_protocol) {
+      trace_end(trace_protocol, protocol_name_source, 0);
+      metrics_protocol_ended(aborting);
+    }
     current_protocol = NULL;
+    abort_action = NULL;
+    abort_action_args = NULL;
+    current_priority = priority_background;
+    resume_pending = false;
+    if (num_suspended > 0) {
+      // put back the protocol this one preempted; it was suspended between steps, so its next step is due
+      suspended_protocol_t * s = &(suspended[--num_suspended]);
+      set_current_protocol(s->protocol);
+      strncpy(protocol_name, s->name_source, MAX_PROTOCOL_STRING_SIZE);  // not set_protocol_name, its trace span is still open
+      protocol_name_source = s->name_source;
+      abort_action = s->abort_action;
+      abort_action_args = s->abort_action_args;
+      current_priority = s->priority;
+      set_met_expectations(s->met_expectations);
+      resume_pending = true;
+    }
 }
 
-char protocol_name[MAX_PROTOCOL_STRING_SIZE];
-void set_protocol_name(char *proto_name) { strncpy(protocol_name, proto_name, MAX_PROTOCOL_STRING_SIZE); }
+// same as clearing, but for when the protocol did not finish, so first undo whatever it asked to be undone
+void abort_current_protocol() {
+  action_ptr_t action = abort_action;
+  record_abort(protocol_name_source);
+  abort_action = NULL;
+  if (action) (*action)(abort_action_args);
+  aborting = true;
+  clear_current_protocol();
+  aborting = false;
+}
+
+void on_protocol_abort(action_ptr_t action, void * args) {
+  abort_action = action;
+  abort_action_args = args;
+}
+
+static int longest_protocol_name = 0;
+void set_protocol_name(char *proto_name) { 
+  int len = strlen(proto_name);
+  strncpy(protocol_name, proto_name, MAX_PROTOCOL_STRING_SIZE); 
+  protocol_name_source = proto_name; 
+  trace_begin(trace_protocol, protocol_name_source, 0);
+  if (len > longest_protocol_name) longest_protocol_name = len;
+}
+int get_longest_protocol_name() { return longest_protocol_name; }
 char * get_protocol_name() { return protocol_name; }
 
 void wait_for_protocol_finish() {
-  while (current_protocol) delay(500);
+  while (protocol_running()) delay(500);
 }
 
 bool protocol_running() {
-  return (current_protocol != NULL);
+  return (current_protocol != NULL) || (num_suspended > 0) || (waiting_protocol != NULL);
+}
+
+protocol_priority_t get_protocol_priority() {
+  return current_priority;
+}
+
+int num_suspended_protocols() {
+  return num_suspended;
+}
+
+static bool is_active(protocol_ptr_t protocol) {
+  if (protocol == current_protocol) return true;
+  for (int i = 0; i < num_suspended; i++) {
+    if (suspended[i].protocol == protocol) return true;
+  }
+  return false;
+}
+
+// only called when the current protocol is between steps
+static void suspend_current_protocol() {
+  suspended_protocol_t * s = &(suspended[num_suspended++]);
+  PRINTF("suspending protocol %s\n", get_protocol_name())
+  s->protocol = current_protocol;
+  s->name_source = protocol_name_source;
+  s->abort_action = abort_action;
+  s->abort_action_args = abort_action_args;
+  s->priority = current_priority;
+  s->met_expectations = met_expectations();
+  current_protocol = NULL;
+  abort_action = NULL;
+  abort_action_args = NULL;
+  resume_pending = false;
+  num_preemptions++;
+}
+
+static void start_waiting_protocol() {
+  protocol_ptr_t protocol = waiting_protocol;
+  unsigned long waited = millis() - waiting_since;
+  if (waited > max_preemption_wait) max_preemption_wait = waited;
+  waiting_protocol = NULL;
+  current_priority = waiting_priority;
+  if (!(*protocol)() && (current_protocol == protocol)) {
+    PRINTF("current protocol encountered an error - clearing current protocol\n")
+    abort_current_protocol();
+  }
+}
+
+static void resume_current_protocol() {
+  protocol_ptr_t protocol = current_protocol;
+  resume_pending = false;
+  if (!(*protocol)() && (current_protocol == protocol)) {
+    PRINTF("current protocol encountered an error - clearing current protocol\n")
+    abort_current_protocol();
+  }
+}
+
+// runs whatever is due: a waiting protocol that can start (suspending the current one if it is between steps) or the next step of the current one
+static void run_pending_protocols() {
+  while (true) {
+    if (waiting_protocol && !current_protocol) start_waiting_protocol();
+    else if (waiting_protocol && resume_pending && (waiting_priority > current_priority) && (num_suspended < MAX_SUSPENDED_PROTOCOLS)) {
+      suspend_current_protocol();
+      start_waiting_protocol();
+    }
+    else if (resume_pending && current_protocol) resume_current_protocol();
+    else break;
+  }
+}
+
+bool request_protocol(protocol_ptr_t protocol, protocol_priority_t priority) {
+  if (is_active(protocol) || waiting_protocol) return false;
+  if (current_protocol && ((priority <= current_priority) || (num_suspended >= MAX_SUSPENDED_PROTOCOLS))) return false;
+  waiting_protocol = protocol;
+  waiting_priority = priority;
+  waiting_since = millis();
+  run_pending_protocols();
+  return true;
+}
+
+void print_preemption_stats() {
+  PRINTF("protocols preempted: %u, longest wait for a requested protocol to start: %lu ms\n", num_preemptions, max_preemption_wait)
 }
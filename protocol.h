@@ -36,6 +36,10 @@
  *  case the implementation of protocol status changes in the future. You can use ABORT_PROTOCOL to indicate
  *  the protocol has failed. The framework will also automatically abort protocols if it detects an error.
  *  
+ *  ON_ABORT(action, args) sets an action that is run if the protocol is aborted for any reason (ABORT_PROTOCOL, an action
+ *  failing, or being aborted from outside like after a reset), e.g., to undo partial results. It is forgotten when the
+ *  protocol ends, and ON_ABORT(NO_ACTION, NO_ARGS) forgets it sooner (e.g., once the results are complete). 
+ *  
  *  There is also a bool variable called ret that is used internally to get success or failure of
  *  functions called inside the framework; you can also use this variable for temporary status of
  *  functions you call too.
@@ -44,6 +48,8 @@
  *  
  *  Framework implementation notes:
  *  - much of the implemenation is inside the macros in this header file.
+ *  - a protocol that is called when it is not the current protocol (i.e., it is being started, not resumed by
+ *    run_current_protocol) always starts at its first step, even if it was previously aborted part way through.
  *  - the mechanism to enable the step function to pick up at the last step is using two counters: 
  *    one counter (state) is static and keeps track of the next step to be run and the other
  *    counter (state_compare) increments each time it is compared to the step to be run.
@@ -54,6 +60,8 @@
  *  - BEGIN_PROTOCOL sets up the first comparison step
  *  - RUN_PRODUCTION ends the comparison and sets up the next comparison. 
  *  - RUN_PRODUCTION_AND_REPEAT_IF(some_condition) works like an until statement for the production. 
+ *  - RUN_PRODUCTION_UNLESS(some_condition) skips the production (nothing should have been performed for it) and goes straight on to
+ *    the next step without waiting for an event, e.g., when a pooled connection is already open so there is nothing to connect. 
  *  - END_PROTOCOL ends the last comparison and the protocol function
  *  
  *  See protocol.cpp for the implementations of the functions to set, get, and run the current protocol.
@@ -91,6 +99,8 @@
 #ifndef PROTOCOL_H
 #define PROTOCOL_H
 
+#include "production.h"
+
 typedef bool (*protocol_ptr_t)();
 typedef bool (protocol_t)();
 
@@ -98,13 +108,32 @@ void run_current_protocol(void *pckt);
 void set_current_protocol(protocol_ptr_t protocol);
 protocol_ptr_t get_current_protocol();
 void clear_current_protocol();
+void abort_current_protocol();
+void on_protocol_abort(action_ptr_t abort_action, void * args);
 void wait_for_protocol_finish();
-bool protocol_running();
+bool protocol_running();   // true while a protocol is current, suspended, or waiting to start
+
+/*
+ * Priority classes. A protocol called directly (e.g., gatt_walk_protocol() from a step function) runs as priority_background.
+ * request_protocol starts a protocol now if nothing is running; if something with a lower priority is running, it is suspended at
+ * the end of its current production (so an urgent read waits for at most one production of a walk, not the whole walk), the new
+ * protocol runs, and then the suspended one picks up at its next step, with its abort action and met_expectations() as they were.
+ * It returns false if the protocol can't be started or queued (something of the same or higher priority is running or waiting,
+ * it is already running or suspended, or MAX_SUSPENDED_PROTOCOLS are already suspended); just ask again later in that case.
+ * A suspended protocol keeps its connection open while suspended, so the controller needs room for one more link per suspension.
+ */
+typedef enum {priority_background, priority_normal, priority_urgent} protocol_priority_t;
+#define MAX_SUSPENDED_PROTOCOLS 2
+bool request_protocol(protocol_ptr_t protocol, protocol_priority_t priority);
+protocol_priority_t get_protocol_priority();
+int num_suspended_protocols();
+void print_preemption_stats();
 
 //There is a string version of the protocol name used in debugging statements, limited to the following size. 
 #define MAX_PROTOCOL_STRING_SIZE 40
 void set_protocol_name(char * proto_name);
 char * get_protocol_name();
+int get_longest_protocol_name();
 
 /*
  * Here are the macros which provide a domain specific language for protocol functions.
@@ -116,7 +145,8 @@ bool protocol_name() {              \
   uint16_t state_compare = 0;       \
   static uint16_t state = 0;        \
   bool protocol_success = true;     \
-  bool ret;
+  bool ret;                         \
+  if (get_current_protocol() != protocol_name) state = 0;
 
 #define BEGIN_PROTOCOL(protocol_name)    \
   if (state == state_compare++) {        \
@@ -127,7 +157,7 @@ bool protocol_name() {              \
     ret = run_action_only_once();        \
     if (!ret) {                          \
       PRINTF("action %s failed, aborting protocol %s \n", get_action_name(), get_protocol_name()); \
-      clear_current_protocol();         \
+      abort_current_protocol();         \
     }                                   \
     else state++;                       \
     return protocol_success;            \       
@@ -139,7 +169,7 @@ bool protocol_name() {              \
     ret = run_action_only_once();          \
     if (!ret) {                            \
       PRINTF("action %s failed, aborting protocol %s \n", get_action_name(), get_protocol_name()); \
-      clear_current_protocol();            \
+      abort_current_protocol();            \
     }                                      \
     else {                                 \ 
       if (!(cond)) state++;                \
@@ -148,9 +178,25 @@ bool protocol_name() {              \
   }                                        \
   if (state == state_compare++) {  
 
+#define RUN_PRODUCTION_UNLESS(skip)        \
+    if (!(skip)) {                         \
+      ret = run_action_only_once();        \
+      if (!ret) {                          \
+        PRINTF("action %s failed, aborting protocol %s \n", get_action_name(), get_protocol_name()); \
+        abort_current_protocol();          \
+      }                                    \
+      else state++;                        \
+      return protocol_success;             \
+    }                                      \
+    state++;                               \
+  }                                        \
+  if (state == state_compare++) {  
+
 #define ABORT_PROTOCOL                     \
-  protocol_success = false;                \
-  return false;
+  { protocol_success = false; return false; }
+
+#define ON_ABORT(act, args)         \
+  on_protocol_abort(act, args);
 
 #define PROTOCOL_IS_WORKING         \
   protocol_success = true;
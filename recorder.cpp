@@ -0,0 +1,159 @@
+/*!
+ * @file recorder.cpp
+ * @brief Implementation of the flight recorder
+ * @details
+ * Records are kept in a fixed size ring buffer. Adding a record is just a few assignments so that it can be left on in normal operation;
+ * nothing is printed until the recorder is frozen and recorder_poll is called.
+ * 
+ *  fine-print: copyright 2021 David Hamilton. This software may be freely copied and used under MIT license (see LICENSE.txt in root directory).
+ */
+
+/*
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "recorder.h"
+#include "dbprint.h"
+
+typedef struct record_s {
+  unsigned long time;   // micros()
+  const char * name;
+  uint16_t code;
+  uint8_t  kind;
+  uint8_t  value;
+} record_t;
+
+static record_t records[RECORDER_SIZE];
+static int next_record = 0;
+static int num_recorded = 0;
+
+static bool recording = false;
+static bool triggered = false;
+static bool frozen = false;
+static int  post_trigger = RECORDER_POST_TRIGGER;
+static int  post_remaining;
+static const char * trigger_reason;
+static unsigned long trigger_time;
+
+static bool trigger_on_abort = false;
+static bool trigger_on_action_failure = false;
+static uint16_t trigger_ecode = 0;
+static unsigned long trigger_latency = 0;
+
+void recorder_start() {
+  next_record = 0;
+  num_recorded = 0;
+  triggered = false;
+  frozen = false;
+  recording = true;
+}
+
+void recorder_stop() { recording = false; }
+
+void recorder_trigger_on_abort(bool on) { trigger_on_abort = on; }
+void recorder_trigger_on_action_failure(bool on) { trigger_on_action_failure = on; }
+void recorder_trigger_on_ecode(uint16_t ecode) { trigger_ecode = ecode; }
+void recorder_trigger_on_latency(unsigned long microseconds) { trigger_latency = microseconds; }
+
+void recorder_post_trigger(int num_records) {
+  if (num_records >= RECORDER_SIZE) num_records = RECORDER_SIZE - 1;
+  post_trigger = num_records;
+}
+
+bool recorder_frozen() { return frozen; }
+
+void recorder_trigger(const char * reason) {
+  if (!recording || triggered) return;
+  triggered = true;
+  trigger_reason = reason;
+  trigger_time = micros();
+  post_remaining = post_trigger;
+  if (post_remaining == 0) frozen = true;
+}
+
+static void add_record(rec_kind_t kind, const char * name, uint16_t code, uint8_t value) {
+  record_t * r;
+  if (!recording || frozen) return;
+  r = &(records[next_record]);
+  r->time = micros();
+  r->name = name;
+  r->code = code;
+  r->kind = kind;
+  r->value = value;
+  next_record = (next_record + 1) % RECORDER_SIZE;
+  if (num_recorded < RECORDER_SIZE) num_recorded++;
+  if (triggered && (--post_remaining <= 0)) frozen = true;
+}
+
+void record_event(hci_event_pckt *event_pckt) {
+  evt_blue_aci *evt_blue;
+  evt_le_meta_event *meta_pckt;
+  uint16_t code = event_pckt->evt;
+  uint8_t value = 0;
+  if (!recording || frozen) return;
+  if (event_pckt->evt == EVT_VENDOR) {
+    evt_blue = (evt_blue_aci *) (event_pckt->data);
+    code = evt_blue->ecode;
+    value = 0xFF;
+  }
+  else if (event_pckt->evt == EVT_LE_META_EVENT) {
+    meta_pckt = (evt_le_meta_event *) event_pckt->data;
+    value = meta_pckt->subevent;
+  }
+  add_record(rec_event, NULL, code, value);
+  if (trigger_ecode && (value == 0xFF) && (code == trigger_ecode)) recorder_trigger("ecode");
+}
+
+void record_event_done(unsigned long start_micros) {
+  unsigned long elapsed;
+  if (!recording || frozen) return;
+  elapsed = micros() - start_micros;
+  add_record(rec_event_done, NULL, (elapsed > 0xFFFF) ? 0xFFFF : elapsed, 0);
+  if (trigger_latency && (elapsed > trigger_latency)) recorder_trigger("latency");
+}
+
+void record_action(const char * name, bool result) {
+  add_record(rec_action, name, 0, result);
+  if (trigger_on_action_failure && !result) recorder_trigger("action failed");
+}
+
+void record_abort(const char * name) {
+  add_record(rec_abort, name, 0, 0);
+  if (trigger_on_abort) recorder_trigger("protocol aborted");
+}
+
+void record_note(const char * name, uint16_t code) {
+  add_record(rec_note, name, code, 0);
+}
+
+void recorder_dump() {
+  int i, index;
+  record_t * r;
+  PRINTF("================ FLIGHT RECORDER (%s at %lu us) ================\n", triggered ? trigger_reason : "no trigger", trigger_time)
+  index = (next_record + RECORDER_SIZE - num_recorded) % RECORDER_SIZE;
+  for (i = 0; i < num_recorded; i++) {
+    r = &(records[index]);
+    PRINTF("%10lu ", r->time)
+    switch (r->kind) {
+      case rec_event:
+        if (r->value == 0xFF) PRINTF("event     ecode %04X\n", r->code)
+        else PRINTF("event     evt %02X subevent %02X\n", r->code, r->value)
+        break;
+      case rec_event_done: PRINTF("done      %u us\n", r->code) break;
+      case rec_action:     PRINTF("action    %s returned %s\n", r->name, r->value ? "true" : "false") break;
+      case rec_abort:      PRINTF("abort     %s\n", r->name) break;
+      case rec_note:       PRINTF("note      %s %04X\n", r->name, r->code) break;
+      default:             PRINTF("?\n") break;
+    }
+    index = (index + 1) % RECORDER_SIZE;
+  }
+  PRINTF("==================== END OF FLIGHT RECORDER ====================\n")
+}
+
+void recorder_poll() {
+  if (!frozen) return;
+  recorder_dump();
+  recorder_start();
+}
@@ -0,0 +1,69 @@
+/*!
+ * @file recorder.h
+ * @brief A flight recorder that keeps detailed records of recent events in RAM and dumps them when something interesting happens.
+ * @details
+ * Debug output at high levels (see dbprint.h) is too expensive to leave on all the time, and problems often happen long after DB_print_for
+ * has turned debug output off. The flight recorder instead always keeps the last RECORDER_SIZE records of what happened (events received, 
+ * actions performed, protocols aborted) in a ring buffer, which is cheap since nothing is printed. When a trigger fires, it keeps recording
+ * for a configurable number of records after the trigger and then freezes, so that the records before and after the trigger can be dumped.
+ * 
+ * Triggers can be any combination of:
+ * - a protocol being aborted
+ * - an action (PERFORM) returning false
+ * - a specific vendor ecode being received (e.g., EVT_BLUE_GATT_PROCEDURE_TIMEOUT)
+ * - an event taking longer than a given number of microseconds to process
+ * 
+ * Typical usage:
+ *     recorder_trigger_on_abort(true);
+ *     recorder_trigger_on_latency(20000);
+ *     recorder_start();
+ * and in loop(), recorder_poll() to dump the records once the recorder is frozen (this is done outside of the event callback so that
+ * printing doesn't cause lost events). After dumping, the recorder starts recording again, waiting for the next trigger.
+ * 
+ * The framework adds records itself (see protocol.cpp and production.cpp); applications can add their own with record_note.
+ * 
+ *  fine-print: copyright 2021 David Hamilton. This software may be freely copied and used under MIT license (see LICENSE.txt in root directory).
+ */
+
+/*
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdint.h>
+#include <STBLE.h>
+
+// number of records kept, including the ones after the trigger
+#define RECORDER_SIZE 64
+
+// default number of records to keep after a trigger
+#define RECORDER_POST_TRIGGER 16
+
+typedef enum {rec_event, rec_event_done, rec_action, rec_abort, rec_note} rec_kind_t;
+
+void recorder_start();
+void recorder_stop();
+
+void recorder_trigger_on_abort(bool on);
+void recorder_trigger_on_action_failure(bool on);
+void recorder_trigger_on_ecode(uint16_t ecode);   // 0 to turn off
+void recorder_trigger_on_latency(unsigned long microseconds); // 0 to turn off
+void recorder_post_trigger(int num_records);
+void recorder_trigger(const char * reason);       // fire a trigger manually
+
+bool recorder_frozen();
+void recorder_poll();   // dumps the records if frozen and then starts recording again
+void recorder_dump();
+
+// used by the framework to add records; the name must be a string that stays around (e.g., a literal)
+void record_event(hci_event_pckt *event_pckt);
+void record_event_done(unsigned long start_micros);
+void record_action(const char * name, bool result);
+void record_abort(const char * name);
+void record_note(const char * name, uint16_t code);
+
+#endif
@@ -0,0 +1,185 @@
+/*!
+ * @file relay.cpp
+ * @brief Implementation of the relay of data to a host in batched binary frames
+ * @details
+ * Records are written straight into the frame being filled (there is no intermediate copy), and the frame header and checksum are
+ * filled in when the frame is handed over to be sent.
+ * 
+ *  fine-print: copyright 2021 David Hamilton. This software may be freely copied and used under MIT license (see LICENSE.txt in root directory).
+ */
+
+/*
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stddef.h>
+#include "relay.h"
+#include "dbprint.h"
+
+typedef struct frame_s {
+  uint8_t  bytes[RELAY_FRAME_HEADER_SIZE + RELAY_FRAME_SIZE + 1];
+  int      len;          // bytes of records
+  int      sent;         // bytes written so far when sending
+  unsigned long started; // millis() of the first record
+} frame_t;
+
+static frame_t frames[2];
+static frame_t * filling = &(frames[0]);
+static frame_t * sending = NULL;
+static Stream * relay_out = NULL;
+static uint16_t sequence = 0;
+static relay_stats_t stats;
+static relay_report_filter_t * report_filter = NULL;
+
+void relay_filter_reports(relay_report_filter_t * filter) { report_filter = filter; }
+
+bool relay_sends_to(Stream * out) { return (relay_out != NULL) && (relay_out == out); }
+
+void relay_begin(Stream * out) {
+  relay_out = out;
+  filling = &(frames[0]);
+  filling->len = 0;
+  sending = NULL;
+  memset(&stats, 0, sizeof(stats));
+}
+
+static void put16(uint8_t * p, uint16_t v) { p[0] = v & 0xFF; p[1] = v >> 8; }
+
+static void put32(uint8_t * p, uint32_t v) { put16(p, v & 0xFFFF); put16(p+2, v >> 16); }
+
+// finish the header and checksum of the frame being filled and start sending it
+static void hand_over() {
+  uint8_t checksum = 0;
+  int i;
+  uint8_t * records = filling->bytes + RELAY_FRAME_HEADER_SIZE;
+  for (i=0; i<filling->len; i++) checksum ^= records[i];
+  filling->bytes[0] = 0xA5;
+  filling->bytes[1] = 0x5A;
+  put16(filling->bytes + 2, filling->len);
+  put16(filling->bytes + 4, sequence++);
+  records[filling->len] = checksum;
+  filling->sent = 0;
+  sending = filling;
+  filling = (filling == &(frames[0])) ? &(frames[1]) : &(frames[0]);
+  filling->len = 0;
+}
+
+static void write_some() {
+  int total, n, room;
+  unsigned long latency;
+  if (!sending || !relay_out) return;
+  total = RELAY_FRAME_HEADER_SIZE + sending->len + 1;
+  room = relay_out->availableForWrite();
+  n = total - sending->sent;
+  if (n > room) n = room;
+  if (n > 0) sending->sent += relay_out->write(sending->bytes + sending->sent, n);
+  if (sending->sent >= total) {
+    latency = millis() - sending->started;
+    if (latency > stats.max_latency) stats.max_latency = latency;
+    stats.frames++;
+    stats.bytes += total;
+    sending = NULL;
+  }
+}
+
+void relay_poll() {
+  write_some();
+  if (!sending && (filling->len > 0)) {
+    if ((filling->len >= RELAY_FLUSH_SIZE) || ((millis() - filling->started) >= RELAY_FLUSH_AGE_MS)) {
+      hand_over();
+      write_some();
+    }
+  }
+}
+
+void relay_flush() {
+  write_some();
+  if (!sending && (filling->len > 0)) hand_over();
+  write_some();
+}
+
+bool relay_record(uint8_t type, uint16_t source, uint16_t tag, const uint8_t * value, uint8_t len) {
+  uint8_t * r;
+  if (filling->len + RELAY_RECORD_HEADER_SIZE + len > RELAY_FRAME_SIZE) {
+    // the frame being filled is full; it can only be handed over if the other one has been sent
+    write_some();
+    if (sending) {
+      stats.dropped++;
+      return false;
+    }
+    hand_over();
+  }
+  if (filling->len == 0) filling->started = millis();
+  r = filling->bytes + RELAY_FRAME_HEADER_SIZE + filling->len;
+  r[0] = type;
+  r[1] = len;
+  put16(r+2, source);
+  put16(r+4, tag);
+  put32(r+6, millis());
+  memcpy(r + RELAY_RECORD_HEADER_SIZE, value, len);
+  filling->len += RELAY_RECORD_HEADER_SIZE + len;
+  stats.records++;
+  return true;
+}
+
+bool relay_event(hci_event_pckt *event_pckt, arg_t handle_read) {
+  evt_blue_aci *evt_blue;
+  evt_gatt_attr_notification * notification;
+  evt_gatt_indication * indication;
+  evt_att_read_resp * read_resp;
+  if (event_pckt->evt != EVT_VENDOR) return false;
+  evt_blue = (evt_blue_aci *) (event_pckt->data);
+  switch (evt_blue->ecode) {
+    case EVT_BLUE_GATT_NOTIFICATION:
+      notification = (evt_gatt_attr_notification *) evt_blue->data;
+      // event_data_length includes the attribute handle
+      if (notification->event_data_length < 2) return false;
+      return relay_record(relay_notification, notification->conn_handle, notification->attr_handle, notification->attr_value, notification->event_data_length - 2);
+    case EVT_BLUE_GATT_INDICATION:
+      indication = (evt_gatt_indication *) evt_blue->data;
+      if (indication->event_data_length < 2) return false;
+      return relay_record(relay_indication, indication->conn_handle, indication->attr_handle, indication->attr_value, indication->event_data_length - 2);
+    case EVT_BLUE_ATT_READ_RESP:
+      read_resp = (evt_att_read_resp *) evt_blue->data;
+      return relay_record(relay_read_result, read_resp->conn_handle, handle_read ? *((uint16_t *) handle_read) : 0, read_resp->attribute_value, read_resp->event_data_length);
+    default:
+      DBMSG(DBL_ERRORS, "relay_event called on an event it can't relay")
+      return false;
+  }
+}
+
+bool relay_advertising_reports(hci_event_pckt *event_pckt, DUMMY_ARG) {
+  evt_le_meta_event *meta_pckt;
+  uint8_t num_reports, report_num;
+  uint8_t * report;
+  uint8_t * end;
+  int report_len;
+  bool relayed = true;
+  if (event_pckt->evt != EVT_LE_META_EVENT) return false;
+  meta_pckt = (evt_le_meta_event *) event_pckt->data;
+  if (meta_pckt->subevent != EVT_LE_ADVERTISING_REPORT) return false;
+  num_reports = meta_pckt->data[0];
+  report = meta_pckt->data + 1;
+  end = event_pckt->data + event_pckt->plen;
+  for (report_num = 0; report_num < num_reports; report_num++) {
+    // header fields up to data_length, the data, and the RSSI after it
+    if (report + offsetof(le_advertising_info, data_RSSI) > end) break;
+    report_len = offsetof(le_advertising_info, data_RSSI) + ((le_advertising_info *) report)->data_length + 1;
+    if (report + report_len > end) break;
+    if (report_filter && !(*report_filter)((le_advertising_info *) report)) {
+      report += report_len;
+      continue;
+    }
+    if (!relay_record(relay_advertising_report, report_num, 0, report, report_len)) relayed = false;
+    report += report_len;
+  }
+  return relayed;
+}
+
+void get_relay_stats(relay_stats_t * s) { *s = stats; }
+
+void print_relay_stats() {
+  PRINTF("relay: %lu frames, %lu records, %lu dropped, %lu bytes, max latency %lu ms\n", stats.frames, stats.records, stats.dropped, stats.bytes, stats.max_latency)
+}
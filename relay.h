@@ -0,0 +1,99 @@
+/*!
+ * @file relay.h
+ * @brief Relay of data from BLE peripherals to a host over serial, in batched binary frames.
+ * @details
+ * Printing each value as it arrives (PRINTF) costs a formatted write per value and blocks when the serial port can't keep up. Instead, the
+ * relay adds each value as a small binary record to a frame, and sends whole frames when they are big enough (RELAY_FLUSH_SIZE) or old
+ * enough (RELAY_FLUSH_AGE_MS). There are two frame buffers: one being filled and one being sent, and sending never waits for the serial 
+ * port (relay_poll only writes what the port can take without blocking). If both buffers are busy, new records are dropped and counted.
+ * 
+ * Frame format (all multi-byte fields little endian):
+ * 
+ *     0xA5 0x5A  length(2)  sequence(2)  records...  checksum(1)
+ * 
+ * length is the number of bytes of records, sequence goes up by one for every frame (so the host can detect lost frames), and
+ * checksum is the xor of all the record bytes. Each record is:
+ * 
+ *     type(1)  length(1)  source(2)  tag(2)  timestamp(4)  value...
+ * 
+ * where length is the length of the value, source is the connection handle (or whatever makes sense for the record type), tag is the 
+ * attribute handle, and timestamp is millis() when the record was added. See relay_record_type_t for the record types.
+ * 
+ * Typical usage:
+ *     relay_begin(&SerialUSB);
+ *     expect_globally(ecode, EVT_BLUE_GATT_NOTIFICATION, AND_DO(relay_event), WITH(NO_ARGS));
+ *     expect(ecode, EVT_BLUE_ATT_READ_RESP, AND_DO(relay_event), WITH(&handle_being_read));
+ * and call relay_poll() from loop().
+ * 
+ * For sniffing, relay_advertising_reports relays every advertising report as it was received from the controller, i.e., the raw 
+ * le_advertising_info: evt_type(1) bdaddr_type(1) bdaddr(6) data_length(1) data... rssi(1). Source is the index of the report in its
+ * event and tag is 0. With priority lanes, reports dropped because the advertising lane was full are not relayed (see lanes.h). With
+ * relay_filter_reports, each report is relayed only if it passes the filter (e.g., advfilter_accepts_report, see advfilter.h).
+ * At ~50 bytes a report, a frame carries 7 or so reports instead of ~100 bytes of text per report:
+ *     expect(event_check, SPECIFICALLY(EVT_LE_META_EVENT), AND_DO(relay_advertising_reports), WITH(NO_ARGS));
+ * 
+ * The frames are binary and relay_poll may leave one half written until the port has room, so nothing else can be written to the port
+ * meanwhile. Debug output always goes to SerialUSB, and PRINTF isn't limited by level or by DB_print_for, so either relay over another
+ * port or call DB_mute(true) to keep all text off SerialUSB while relaying there.
+ * 
+ *  fine-print: copyright 2021 David Hamilton. This software may be freely copied and used under MIT license (see LICENSE.txt in root directory).
+ */
+
+/*
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <Arduino.h>
+#include "production.h"
+
+#define RELAY_FRAME_SIZE 512      // max bytes of records in a frame
+#define RELAY_FLUSH_SIZE 384      // send a frame once it has this many bytes of records
+#define RELAY_FLUSH_AGE_MS 50     // or once its first record is this old
+
+#define RELAY_FRAME_HEADER_SIZE 6
+#define RELAY_RECORD_HEADER_SIZE 10
+
+typedef enum {
+  relay_notification = 1,
+  relay_indication = 2,
+  relay_read_result = 3,
+  relay_advertising_report = 4,
+  relay_metrics = 5,            // a metrics_block_t snapshot, with source the METRICS_VERSION (see metrics.h)
+  relay_filter_reply = 6        // the text answer to a filter program sent over the relay's own port (see advfilter.h)
+} relay_record_type_t;
+
+typedef struct relay_stats_s {
+  unsigned long frames;
+  unsigned long records;
+  unsigned long dropped;
+  unsigned long bytes;
+  unsigned long max_latency;   // ms from the first record of a frame being added to the frame being completely written
+} relay_stats_t;
+
+void relay_begin(Stream * out);
+void relay_poll();
+void relay_flush();   // send what there is now (still without blocking)
+
+bool relay_record(uint8_t type, uint16_t source, uint16_t tag, const uint8_t * value, uint8_t len);
+
+// action: relays notifications, indications and read responses (args can point to the uint16_t handle that was read, to use as the tag)
+bool relay_event(hci_event_pckt *event_pckt, arg_t handle_read);
+
+// action: relays all the advertising reports of an EVT_LE_ADVERTISING_REPORT (other LE meta events are ignored), or only those passing
+// the report filter if one is set
+bool relay_advertising_reports(hci_event_pckt *event_pckt, DUMMY_ARG);
+
+typedef bool (relay_report_filter_t)(le_advertising_info * report);
+void relay_filter_reports(relay_report_filter_t * filter);   // NULL to relay every report
+
+bool relay_sends_to(Stream * out);   // so that others writing to a port can tell it carries frames
+
+void get_relay_stats(relay_stats_t * stats);
+void print_relay_stats();
+
+#endif
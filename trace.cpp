@@ -0,0 +1,111 @@
+/*!
+ * @file trace.cpp
+ * @brief Implementation of timeline tracing
+ * @details
+ * Each record is a timestamp, a pointer to the name, an id (event code, connection handle, etc.), the kind of span, and whether it is
+ * the beginning or end. Converting to JSON is only done when dumping.
+ * 
+ *  fine-print: copyright 2021 David Hamilton. This software may be freely copied and used under MIT license (see LICENSE.txt in root directory).
+ */
+
+/*
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "trace.h"
+#include "dbprint.h"
+
+typedef struct trace_record_s {
+  unsigned long time;    // micros()
+  const char * name;
+  uint16_t id;
+  uint8_t  kind;
+  uint8_t  begin;
+} trace_record_t;
+
+static trace_record_t trace_records[TRACE_SIZE];
+static int next_trace_record = 0;
+static int num_trace_records = 0;
+static bool tracing = false;
+static uint16_t traced_event_code;
+
+static const char * kind_names[] = {"protocol", "production", "action", "event", "connection"};
+
+void trace_start() {
+  next_trace_record = 0;
+  num_trace_records = 0;
+  tracing = true;
+}
+
+void trace_stop() { tracing = false; }
+
+static void add_trace_record(trace_kind_t kind, const char * name, uint16_t id, bool begin) {
+  trace_record_t * r;
+  if (!tracing) return;
+  r = &(trace_records[next_trace_record]);
+  r->time = micros();
+  r->name = name;
+  r->id = id;
+  r->kind = kind;
+  r->begin = begin;
+  next_trace_record = (next_trace_record + 1) % TRACE_SIZE;
+  if (num_trace_records < TRACE_SIZE) num_trace_records++;
+}
+
+void trace_begin(trace_kind_t kind, const char * name, uint16_t id) { add_trace_record(kind, name, id, true); }
+
+void trace_end(trace_kind_t kind, const char * name, uint16_t id) { add_trace_record(kind, name, id, false); }
+
+void trace_event_begin(hci_event_pckt *event_pckt) {
+  evt_le_meta_event * meta_pckt;
+  evt_le_connection_complete * connection_complete_pckt;
+  evt_disconn_complete * disconnection_complete_pckt;
+  if (!tracing) return;
+  traced_event_code = event_pckt->evt;
+  switch (event_pckt->evt) {
+    case EVT_VENDOR:
+      traced_event_code = ((evt_blue_aci *) (event_pckt->data))->ecode;
+      break;
+    case EVT_LE_META_EVENT:
+      meta_pckt = (evt_le_meta_event *) event_pckt->data;
+      if (meta_pckt->subevent == EVT_LE_CONN_COMPLETE) {
+        connection_complete_pckt = (evt_le_connection_complete *) meta_pckt->data;
+        if (connection_complete_pckt->status == 0) trace_begin(trace_connection, "connection", connection_complete_pckt->handle);
+      }
+      break;
+    case EVT_DISCONN_COMPLETE:
+      disconnection_complete_pckt = (evt_disconn_complete *) event_pckt->data;
+      trace_end(trace_connection, "connection", disconnection_complete_pckt->handle);
+      break;
+  }
+  trace_begin(trace_event, "event", traced_event_code);
+}
+
+void trace_event_end() { trace_end(trace_event, "event", traced_event_code); }
+
+// Chrome shows each tid as its own track; connections get a track per handle
+static unsigned int track(trace_record_t * r) {
+  if (r->kind == trace_connection) return 100 + r->id;
+  return r->kind + 1;
+}
+
+void trace_dump() {
+  int i, index;
+  trace_record_t * r;
+  PRINTF("==================== TRACE BEGIN ====================\n")
+  PRINTF("{\"traceEvents\":[\n")
+  index = (next_trace_record + TRACE_SIZE - num_trace_records) % TRACE_SIZE;
+  for (i = 0; i < num_trace_records; i++) {
+    r = &(trace_records[index]);
+    // printed in pieces to stay within the PRINTF buffer
+    PRINTF("{\"name\":\"%s", r->name ? r->name : "?")
+    if (r->kind == trace_event) PRINTF(" %04X", r->id)
+    PRINTF("\",\"cat\":\"%s\",\"ph\":\"%c\",", kind_names[r->kind], r->begin ? 'B' : 'E')
+    PRINTF("\"ts\":%lu,\"pid\":1,\"tid\":%u}%s\n", r->time, track(r), (i < num_trace_records - 1) ? "," : "")
+    index = (index + 1) % TRACE_SIZE;
+  }
+  PRINTF("]}\n")
+  PRINTF("===================== TRACE END =====================\n")
+}
@@ -0,0 +1,53 @@
+/*!
+ * @file trace.h
+ * @brief Timeline tracing of protocols, productions, actions, events, and connections, viewable in Chrome's trace viewer or Perfetto.
+ * @details
+ * Sequential debug output doesn't show what overlaps what or where time is spent idle (e.g., waiting for a GATT procedure to complete).
+ * When tracing is on, the framework adds begin and end records for:
+ * - protocols (from BEGIN_PROTOCOL until the protocol ends or is aborted)
+ * - productions, named by the action performed (from PERFORM until the until condition is met); for ATT operations like discover_characteristcs
+ *   this is the time of the whole ATT procedure, up to EVT_BLUE_GATT_PROCEDURE_COMPLETE
+ * - actions (PERFORM actions by name, and actions of expectations)
+ * - processing of each event received (named by event code)
+ * - connections (from EVT_LE_CONN_COMPLETE to EVT_DISCONN_COMPLETE, one track per connection handle)
+ * 
+ * Records are kept in binary form (a few bytes each) in a ring buffer of TRACE_SIZE records, so tracing a whole walk costs very little time.
+ * trace_dump prints the buffer as Chrome trace event JSON; copy everything between the TRACE BEGIN/END lines into a .json file and open it in
+ * chrome://tracing or ui.perfetto.dev. If the ring wrapped, the oldest records are gone and some spans will be missing their beginning.
+ * 
+ * Typical usage:
+ *     trace_start();
+ *     ... run protocols ...
+ *     trace_stop();
+ *     trace_dump();
+ * 
+ *  fine-print: copyright 2021 David Hamilton. This software may be freely copied and used under MIT license (see LICENSE.txt in root directory).
+ */
+
+/*
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <STBLE.h>
+
+#define TRACE_SIZE 128
+
+typedef enum {trace_protocol, trace_production, trace_action, trace_event, trace_connection} trace_kind_t;
+
+void trace_start();
+void trace_stop();
+void trace_dump();
+
+// used by the framework; names must be strings that stay around (e.g., literals)
+void trace_begin(trace_kind_t kind, const char * name, uint16_t id);
+void trace_end(trace_kind_t kind, const char * name, uint16_t id);
+void trace_event_begin(hci_event_pckt *event_pckt);
+void trace_event_end();
+
+#endif